@@ -0,0 +1,747 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+
+// Headless benchmark runner for caw programs.
+//
+// Each selected program is loaded, initialized and then executed for a fixed
+// count of cycles by calling io_flow_ctl::exec() directly with a synthetic audio
+// message - no audio device is opened and no UI is created. The load/init time,
+// the memory use and the distribution of the per-cycle execution time are written
+// to a JSON file so that results can be compared across libcw updates.
+//
+// Usage: caw_bench <bench_cfg_fname> {<program_label> | all} {<cycle_cnt>} {<json_out_fname>} {--run | --gen_baseline | --compare}
+//
+//   --run          : Write the results to <json_out_fname>. (default)
+//   --gen_baseline : Write the results to the baseline file. Baseline entries for programs which were not run,
+//                    or which failed, are kept.
+//   --compare      : As '--run' but fail if the p99 cycle time or init time of a program regressed past the
+//                    threshold relative to the baseline.
+//
+// The mode may appear anywhere after the bench cfg. file name.
+//
+// The bench cfg. is an ordinary caw program cfg. with an additional 'bench' record:
+//    bench: { cycle_cnt:20000, warmup_cycle_cnt:200, ch_cnt:2, out_fname:"bench_results.json",
+//             baseline_fname:"bench_baseline.json", p99_thresh_pct:10, init_thresh_pct:25 }
+// The baseline file is kept next to the bench cfg. See bench/bench.cfg.
+
+#include "cwCommon.h"
+#include "cwLog.h"
+#include "cwCommonImpl.h"
+#include "cwMem.h"
+#include "cwText.h"
+#include "cwObject.h"
+#include "cwFileSys.h"
+#include "cwTime.h"
+#include "cwIo.h"
+
+#include "cwFlowDecl.h"
+#include "cwIoFlowCtl.h"
+
+#include "cawPerf.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <string>
+
+using namespace cw;
+
+typedef std::chrono::steady_clock bench_clock_t;
+
+enum {
+  kRunModeId,
+  kGenBaselineModeId,
+  kCompareModeId
+};
+
+idLabelPair_t modeA[] = {
+  { kRunModeId,         "run" },
+  { kGenBaselineModeId, "gen_baseline" },
+  { kCompareModeId,     "compare" },
+
+  { kInvalidId, nullptr }
+};
+
+typedef struct result_str
+{
+  char*              label;
+  rc_t               rc;
+  double             load_ms;          // program_load() time
+  double             init_ms;          // program_initialize() time
+  unsigned           rss_rise_kb;      // rise of the resident set size from before the program was created to following initialization
+  unsigned           peak_rss_rise_kb; // rise of the peak resident set size over the same starting size, following execution
+  unsigned           over_budget_cnt;  // count of cycles which took longer than the real-time budget
+  caw::perf::stats_t cycle_us;         // per-cycle execution time in microseconds
+} result_t;
+
+typedef struct bench_str
+{
+  const char*           cfg_fname;
+  object_t*             flow_cfg;
+  object_t*             io_cfg;
+  object_t*             baseline_cfg;
+  unsigned              modeId;            // kRunModeId | kGenBaselineModeId | kCompareModeId
+
+  unsigned              cycle_cnt;
+  unsigned              warmup_cycle_cnt;
+  const char*           out_fname;
+  std::string           baseline_fname;    // resolved relative to the bench cfg.
+  double                p99_thresh_pct;    // max. allowed increase of the p99 cycle time in percent
+  double                init_thresh_pct;   // max. allowed increase of the initialization time in percent
+
+  double                srate;
+  unsigned              dspFrameCnt;
+  double                base_srate;        // sample rate and block size of the baseline file
+  unsigned              base_dspFrameCnt;  //
+  unsigned              groupId;           // id of the first audio group
+  unsigned              chCnt;             // count of input and of output channels of the synthetic audio cycle
+  double                budget_us;         // duration of one cycle of audio
+
+  io::sample_t*         sampleA;           // sampleA[ 2*chCnt*dspFrameCnt ] zeroed input and output channel buffers
+  io::sample_t**        iChA;              // iChA[ chCnt ]
+  io::sample_t**        oChA;              // oChA[ chCnt ]
+  time::spec_t          timeStamp;         // time stamp of the synthetic audio cycle
+
+  io::handle_t          ioH;
+  double*               cycle_usA;         // cycle_usA[ cycle_cnt ]
+
+  result_t*             resultA;           // resultA[ program_count ]
+  unsigned              resultN;
+
+  result_t*             baseA;             // baseA[ baseN ] baseline results
+  unsigned              baseN;
+} bench_t;
+
+double _elapsed_us( const bench_clock_t::time_point& t0, const bench_clock_t::time_point& t1 )
+{ return std::chrono::duration<double,std::micro>(t1-t0).count(); }
+
+unsigned _rise_kb( unsigned kb, unsigned kb0 )
+{ return kb > kb0 ? kb - kb0 : 0; }
+
+rc_t _io_callback( void* arg, const io::msg_t* m )
+{ return kOkRC; }
+
+// Resolve 'fname' relative to the directory of the bench cfg. file unless it is absolute.
+std::string _resolve_path( const char* cfg_fname, const char* fname )
+{
+  std::string cfg_fn(cfg_fname);
+  size_t      i = cfg_fn.rfind('/');
+
+  if( fname[0] == '/' || fname[0] == '~' || i == std::string::npos )
+    return std::string(fname);
+
+  return cfg_fn.substr(0,i+1) + fname;
+}
+
+rc_t _parse_cfg( bench_t& b, int argc, char* argv[], const char*& pgm_label_ref )
+{
+  rc_t            rc        = kOkRC;
+  const char*     io_cfg_fn = nullptr;
+  const object_t* bench_cfg = nullptr;
+  const object_t* groupL    = nullptr;
+  const char*     base_fn   = "bench_baseline.json";
+  const char*     argA[3]   = { nullptr, nullptr, nullptr }; // positional args: program label, cycle count, output file
+  unsigned        argN      = 0;
+  std::string     io_fn;
+
+  b.cycle_cnt        = 20000;
+  b.warmup_cycle_cnt = 200;
+  b.out_fname        = "bench_results.json";
+  b.p99_thresh_pct   = 10;
+  b.init_thresh_pct  = 25;
+  b.srate            = 48000;
+  b.dspFrameCnt      = 64;
+  b.chCnt            = 2;
+  b.modeId           = kRunModeId;
+  pgm_label_ref      = "all";
+
+  if( argc < 2 )
+  {
+    rc = cwLogError(kInvalidArgRC,"Usage: caw_bench <bench_cfg_fname> {<program_label> | all} {<cycle_cnt>} {<json_out_fname>} {--run | --gen_baseline | --compare}");
+    goto errLabel;
+  }
+
+  b.cfg_fname = argv[1];
+
+  if((rc = objectFromFile(b.cfg_fname,b.flow_cfg)) != kOkRC )
+  {
+    rc = cwLogError(rc,"Parsing failed on the bench cfg. file '%s'.",cwStringNullGuard(b.cfg_fname));
+    goto errLabel;
+  }
+
+  if((rc = b.flow_cfg->getv("io_dict", io_cfg_fn)) != kOkRC )
+  {
+    rc = cwLogError(rc,"The bench cfg. 'io_dict' field could not be read.");
+    goto errLabel;
+  }
+
+  io_fn = _resolve_path(b.cfg_fname,io_cfg_fn);
+
+  if((rc = objectFromFile(io_fn.c_str(),b.io_cfg)) != kOkRC )
+  {
+    rc = cwLogError(rc,"Parsing failed on '%s'.",io_fn.c_str());
+    goto errLabel;
+  }
+
+  if((rc = b.flow_cfg->getv_opt("bench",bench_cfg)) != kOkRC )
+  {
+    rc = cwLogError(rc,"The 'bench' cfg. record could not be accessed.");
+    goto errLabel;
+  }
+
+  if( bench_cfg != nullptr )
+    if((rc = bench_cfg->readv("cycle_cnt",        kOptFl, b.cycle_cnt,
+                              "warmup_cycle_cnt", kOptFl, b.warmup_cycle_cnt,
+                              "ch_cnt",           kOptFl, b.chCnt,
+                              "out_fname",        kOptFl, b.out_fname,
+                              "baseline_fname",   kOptFl, base_fn,
+                              "p99_thresh_pct",   kOptFl, b.p99_thresh_pct,
+                              "init_thresh_pct",  kOptFl, b.init_thresh_pct)) != kOkRC )
+    {
+      rc = cwLogError(rc,"The 'bench' cfg. record could not be parsed.");
+      goto errLabel;
+    }
+
+  // the synthetic audio cycle takes its shape from the first audio group
+  if((groupL = b.io_cfg->find_child("audio")) != nullptr && (groupL = groupL->find_child("groupL")) != nullptr && groupL->child_count() > 0 )
+  {
+    if((rc = groupL->child_ele(0)->readv("id",          kOptFl, b.groupId,
+                                         "srate",       kOptFl, b.srate,
+                                         "dspFrameCnt", kOptFl, b.dspFrameCnt)) != kOkRC )
+    {
+      rc = cwLogError(rc,"The bench audio group could not be parsed.");
+      goto errLabel;
+    }
+  }
+
+  b.baseline_fname = _resolve_path(b.cfg_fname,base_fn);
+
+  // command line overrides - the mode is named so that it does not shift the positional args
+  for(int i=2; i<argc; ++i)
+  {
+    if( argv[i][0] == '-' && argv[i][1] == '-' )
+    {
+      if((b.modeId = labelToId(modeA,argv[i]+2,kInvalidId)) == kInvalidId )
+      {
+        rc = cwLogError(kInvalidArgRC,"The bench mode '%s' is not valid. Use '--run', '--gen_baseline' or '--compare'.",argv[i]);
+        goto errLabel;
+      }
+      continue;
+    }
+
+    if( argN == 3 )
+    {
+      rc = cwLogError(kInvalidArgRC,"Unexpected command line argument '%s'.",argv[i]);
+      goto errLabel;
+    }
+
+    argA[ argN++ ] = argv[i];
+  }
+
+  if( argA[0] != nullptr )
+    pgm_label_ref = argA[0];
+
+  if( argA[1] != nullptr )
+    b.cycle_cnt = (unsigned)atoi(argA[1]);
+
+  if( argA[2] != nullptr )
+    b.out_fname = argA[2];
+
+  if( b.cycle_cnt == 0 || b.dspFrameCnt == 0 || b.srate <= 0 )
+  {
+    rc = cwLogError(kInvalidArgRC,"The bench cycle count, sample rate and 'dspFrameCnt' must be greater than zero.");
+    goto errLabel;
+  }
+
+  b.budget_us = b.dspFrameCnt * 1000000.0 / b.srate;
+
+  // the synthetic audio cycle has real (silent) device buffers
+  b.sampleA = mem::allocZ<io::sample_t>(2 * b.chCnt * b.dspFrameCnt);
+  b.iChA    = mem::allocZ<io::sample_t*>(std::max(1u,b.chCnt));
+  b.oChA    = mem::allocZ<io::sample_t*>(std::max(1u,b.chCnt));
+
+  for(unsigned i=0; i<b.chCnt; ++i)
+  {
+    b.iChA[i] = b.sampleA + i * b.dspFrameCnt;
+    b.oChA[i] = b.sampleA + (b.chCnt + i) * b.dspFrameCnt;
+  }
+
+errLabel:
+  return rc;
+}
+
+// Load, initialize and execute one program.
+rc_t _run_program( bench_t& b, unsigned pgm_idx, result_t& r )
+{
+  rc_t                  rc        = kOkRC;
+  io_flow_ctl::handle_t ioFlowH;
+  io::audio_msg_t       audio_msg = {};
+  io::msg_t             msg       = {};
+  unsigned              cycleN    = 0;
+  unsigned              rss0_kb   = 0;
+  bench_clock_t::time_point t0,t1,t2;
+
+  audio_msg.groupId       = b.groupId;
+  audio_msg.srate         = b.srate;
+  audio_msg.dspFrameCnt   = b.dspFrameCnt;
+  audio_msg.iBufArray     = b.iChA;
+  audio_msg.iBufChCnt     = b.chCnt;
+  audio_msg.iTimeStampPtr = &b.timeStamp;
+  audio_msg.oBufArray     = b.oChA;
+  audio_msg.oBufChCnt     = b.chCnt;
+  audio_msg.oTimeStampPtr = &b.timeStamp;
+  msg.tid                 = io::kAudioTId;
+  msg.u.audio             = &audio_msg;
+
+  // The process peak RSS still holds the high-water mark of the previous programs.
+  // Reset it and measure this program's memory as the rise over the current RSS.
+  rss0_kb = caw::perf::current_rss_kb();
+  if( !caw::perf::reset_peak_rss() )
+    cwLogWarning("The peak RSS could not be reset. The peak RSS rise may include the programs run before program %i.",pgm_idx);
+
+  // each program gets a fresh flow controller so that programs do not share state
+  if((rc = create( ioFlowH, b.ioH, b.flow_cfg)) != kOkRC )
+  {
+    rc = cwLogError(rc,"IO-Flow instantiation failed.");
+    goto errLabel;
+  }
+
+  r.label = mem::duplStr(program_title(ioFlowH,pgm_idx));
+
+  t0 = bench_clock_t::now();
+
+  if((rc = program_load(ioFlowH,pgm_idx)) != kOkRC )
+  {
+    rc = cwLogError(rc,"Program load failed on '%s'.",cwStringNullGuard(r.label));
+    goto errLabel;
+  }
+
+  t1 = bench_clock_t::now();
+
+  if((rc = program_initialize(ioFlowH)) != kOkRC )
+  {
+    rc = cwLogError(rc,"Program initialize failed on '%s'.",cwStringNullGuard(r.label));
+    goto errLabel;
+  }
+
+  t2 = bench_clock_t::now();
+
+  r.load_ms     = _elapsed_us(t0,t1) / 1000.0;
+  r.init_ms     = _elapsed_us(t1,t2) / 1000.0;
+  r.rss_rise_kb = _rise_kb(caw::perf::current_rss_kb(),rss0_kb);
+
+  for(unsigned i=0; i<b.warmup_cycle_cnt + b.cycle_cnt && is_executable(ioFlowH); ++i)
+  {
+    time::get(b.timeStamp);
+
+    t0 = bench_clock_t::now();
+
+    if((rc = io_flow_ctl::exec(ioFlowH,msg)) != kOkRC )
+    {
+      rc = cwLogError(rc,"Execution failed on '%s' at cycle %i.",cwStringNullGuard(r.label),i);
+      goto errLabel;
+    }
+
+    t1 = bench_clock_t::now();
+
+    if( i >= b.warmup_cycle_cnt )
+    {
+      double us = _elapsed_us(t0,t1);
+
+      b.cycle_usA[ cycleN++ ] = us;
+
+      if( us > b.budget_us )
+        r.over_budget_cnt += 1;
+    }
+  }
+
+  if( cycleN < b.cycle_cnt )
+    cwLogWarning("'%s' stopped after %i of %i cycles.",cwStringNullGuard(r.label),cycleN,b.cycle_cnt);
+
+  caw::perf::calc_stats(b.cycle_usA,cycleN,r.cycle_us);
+
+  r.peak_rss_rise_kb = _rise_kb(caw::perf::peak_rss_kb(),rss0_kb);
+
+errLabel:
+  r.rc = rc;
+
+  if((rc = destroy(ioFlowH)) != kOkRC )
+    rc = cwLogError(rc,"IO-Flow destroy failed.");
+
+  return r.rc != kOkRC ? r.rc : rc;
+}
+
+// Write 's' as a quoted JSON string.
+void _print_json_string( FILE* fp, const char* s )
+{
+  fputc('"',fp);
+
+  for(; s != nullptr && *s; ++s)
+    switch( *s )
+    {
+      case '"':  fputs("\\\"",fp); break;
+      case '\\': fputs("\\\\",fp); break;
+      case '\n': fputs("\\n",fp);  break;
+      case '\t': fputs("\\t",fp);  break;
+      default:
+        if( (unsigned char)*s < 0x20 )
+          fprintf(fp,"\\u%04x",(unsigned char)*s);
+        else
+          fputc(*s,fp);
+    }
+
+  fputc('"',fp);
+}
+
+void _print_stats_json( FILE* fp, const char* label, const caw::perf::stats_t& s )
+{
+  fprintf(fp,"      \"%s\": { \"n\":%u, \"min\":%.3f, \"mean\":%.3f, \"std\":%.3f, \"p50\":%.3f, \"p90\":%.3f, \"p99\":%.3f, \"p999\":%.3f, \"max\":%.3f }",
+          label, s.n, s.min, s.mean, s.std, s.p50, s.p90, s.p99, s.p999, s.max );
+}
+
+const result_t* _find_result( const result_t* rA, unsigned rN, const char* label )
+{
+  for(unsigned i=0; i<rN; ++i)
+    if( textIsEqual(rA[i].label,label) )
+      return rA + i;
+  return nullptr;
+}
+
+void _print_result_json( FILE* fp, const result_t& r, bool last_fl )
+{
+  fprintf(fp,"    ");
+  _print_json_string(fp,r.label);
+  fprintf(fp,": {\n");
+  fprintf(fp,"      \"rc\": %u,\n",r.rc);
+  fprintf(fp,"      \"load_ms\": %.3f,\n",r.load_ms);
+  fprintf(fp,"      \"init_ms\": %.3f,\n",r.init_ms);
+  fprintf(fp,"      \"rss_rise_kb\": %u,\n",r.rss_rise_kb);
+  fprintf(fp,"      \"peak_rss_rise_kb\": %u,\n",r.peak_rss_rise_kb);
+  fprintf(fp,"      \"over_budget_cnt\": %u,\n",r.over_budget_cnt);
+  _print_stats_json(fp,"cycle_us",r.cycle_us);
+  fprintf(fp,"\n    }%s\n", last_fl ? "" : ",");
+}
+
+// Return the entry of keepA[] which should be written in place of 'r' - a failed run does not replace a previous result.
+const result_t& _result_to_write( const result_t& r, const result_t* keepA, unsigned keepN )
+{
+  const result_t* k = r.rc == kOkRC ? nullptr : _find_result(keepA,keepN,r.label);
+
+  if( k == nullptr )
+    return r;
+
+  cwLogWarning("'%s' failed - its previous entry was kept.",cwStringNullGuard(r.label));
+  return *k;
+}
+
+// Write the current results followed by the entries of keepA[] which were not part of this run.
+rc_t _write_json( const bench_t& b, const char* fname, const result_t* keepA, unsigned keepN )
+{
+  FILE*    fp;
+  char     date[64];
+  time_t   now   = std::time(nullptr);
+  unsigned n     = b.resultN;
+  unsigned k     = 0;
+
+  for(unsigned i=0; i<keepN; ++i)
+    if( _find_result(b.resultA,b.resultN,keepA[i].label) == nullptr )
+      ++n;
+
+  if((fp = fopen(fname,"w")) == nullptr )
+    return cwLogError(kOpenFailRC,"The bench result file '%s' could not be created.",cwStringNullGuard(fname));
+
+  strftime(date,sizeof(date),"%Y-%m-%dT%H:%M:%S",localtime(&now));
+
+  fprintf(fp,"{\n");
+  fprintf(fp,"  \"bench_cfg\": ");
+  _print_json_string(fp,b.cfg_fname);
+  fprintf(fp,",\n");
+  fprintf(fp,"  \"date\": \"%s\",\n",date);
+  fprintf(fp,"  \"srate\": %.1f,\n",b.srate);
+  fprintf(fp,"  \"dsp_frame_cnt\": %u,\n",b.dspFrameCnt);
+  fprintf(fp,"  \"budget_us\": %.3f,\n",b.budget_us);
+  fprintf(fp,"  \"cycle_cnt\": %u,\n",b.cycle_cnt);
+  fprintf(fp,"  \"programs\": {\n");
+
+  for(unsigned i=0; i<b.resultN; ++i,++k)
+    _print_result_json(fp,_result_to_write(b.resultA[i],keepA,keepN),k+1 == n);
+
+  for(unsigned i=0; i<keepN; ++i)
+    if( _find_result(b.resultA,b.resultN,keepA[i].label) == nullptr )
+    {
+      _print_result_json(fp,keepA[i],k+1 == n);
+      ++k;
+    }
+
+  fprintf(fp,"  }\n");
+  fprintf(fp,"}\n");
+
+  fclose(fp);
+
+  return kOkRC;
+}
+
+// Load the baseline file. A missing baseline file is not an error.
+rc_t _read_baseline( bench_t& b )
+{
+  rc_t            rc       = kOkRC;
+  const object_t* pgmL     = nullptr;
+  double          srate    = 0;
+  unsigned        frameCnt = 0;
+
+  if( !filesys::isFile(b.baseline_fname.c_str()) )
+    return kOkRC;
+
+  if((rc = objectFromFile(b.baseline_fname.c_str(),b.baseline_cfg)) != kOkRC )
+  {
+    rc = cwLogError(rc,"Parsing failed on the bench baseline file '%s'.",b.baseline_fname.c_str());
+    goto errLabel;
+  }
+
+  if((rc = b.baseline_cfg->readv("srate",         0, srate,
+                                 "dsp_frame_cnt", 0, frameCnt,
+                                 "programs",      kDictTId, pgmL)) != kOkRC )
+  {
+    rc = cwLogError(rc,"The bench baseline file '%s' header could not be parsed.",b.baseline_fname.c_str());
+    goto errLabel;
+  }
+
+  b.base_srate       = srate;
+  b.base_dspFrameCnt = frameCnt;
+
+  // the old entries are not comparable - 'gen_baseline' does not keep them for failed programs
+  // and _compare_baseline() fails
+  if( srate != b.srate || frameCnt != b.dspFrameCnt )
+  {
+    cwLogWarning("The baseline was generated with srate:%.0f dspFrameCnt:%i but the bench is running with srate:%.0f dspFrameCnt:%i.",srate,frameCnt,b.srate,b.dspFrameCnt);
+    if( b.modeId == kGenBaselineModeId )
+      goto errLabel;
+  }
+
+  b.baseA = mem::allocZ<result_t>(pgmL->child_count());
+
+  for(unsigned i=0; i<pgmL->child_count(); ++i)
+  {
+    const object_t* pair     = pgmL->child_ele(i);
+    const object_t* cycle_us = nullptr;
+    result_t&       r        = b.baseA[ b.baseN++ ];
+    unsigned        r_rc     = kOkRC;
+
+    r.label = mem::duplStr(pair->pair_label());
+
+    if((rc = pair->pair_value()->readv("rc",              0, r_rc,
+                                       "load_ms",         0, r.load_ms,
+                                       "init_ms",         0, r.init_ms,
+                                       "rss_rise_kb",      kOptFl, r.rss_rise_kb,
+                                       "peak_rss_rise_kb", kOptFl, r.peak_rss_rise_kb,
+                                       "over_budget_cnt", 0, r.over_budget_cnt,
+                                       "cycle_us",        kDictTId, cycle_us)) != kOkRC )
+    {
+      rc = cwLogError(rc,"The baseline for '%s' could not be parsed.",cwStringNullGuard(r.label));
+      goto errLabel;
+    }
+
+    if((rc = cycle_us->readv("n",    0, r.cycle_us.n,
+                             "min",  0, r.cycle_us.min,
+                             "mean", 0, r.cycle_us.mean,
+                             "std",  0, r.cycle_us.std,
+                             "p50",  0, r.cycle_us.p50,
+                             "p90",  0, r.cycle_us.p90,
+                             "p99",  0, r.cycle_us.p99,
+                             "p999", 0, r.cycle_us.p999,
+                             "max",  0, r.cycle_us.max)) != kOkRC )
+    {
+      rc = cwLogError(rc,"The baseline cycle time statistics for '%s' could not be parsed.",cwStringNullGuard(r.label));
+      goto errLabel;
+    }
+
+    r.rc = r_rc;
+  }
+
+errLabel:
+  return rc;
+}
+
+// Percent change from 'base' to 'cur'.
+double _change_pct( double base, double cur )
+{ return base <= 0 ? 0 : 100.0 * (cur - base) / base; }
+
+// Compare the current results to the baseline. Returns kTestFailRC if any program regressed.
+rc_t _compare_baseline( const bench_t& b )
+{
+  rc_t rc = kOkRC;
+
+  if( b.baseN == 0 )
+    return cwLogError(kInvalidStateRC,"No baseline was found at '%s'. Run 'gen_baseline' first.",b.baseline_fname.c_str());
+
+  if( b.base_srate != b.srate || b.base_dspFrameCnt != b.dspFrameCnt )
+    return cwLogError(kTestFailRC,"The baseline '%s' (srate:%.0f dspFrameCnt:%i) does not match the bench (srate:%.0f dspFrameCnt:%i). Run 'gen_baseline' again.",
+                      b.baseline_fname.c_str(),b.base_srate,b.base_dspFrameCnt,b.srate,b.dspFrameCnt);
+
+  cwLogInfo("Baseline: %s (p99 threshold:%.1f%% init threshold:%.1f%%)",b.baseline_fname.c_str(),b.p99_thresh_pct,b.init_thresh_pct);
+  cwLogInfo("%-24s %10s %10s %8s %10s %10s %8s %8s","program","base p99","p99","change","base init","init","change","peak+ kB");
+
+  for(unsigned i=0; i<b.resultN; ++i)
+  {
+    const result_t& r    = b.resultA[i];
+    const result_t* base = _find_result(b.baseA,b.baseN,r.label);
+
+    if( r.rc != kOkRC )
+    {
+      rc = cwLogError(kTestFailRC,"FAIL '%s' did not run.",cwStringNullGuard(r.label));
+      continue;
+    }
+
+    if( base == nullptr || base->rc != kOkRC )
+    {
+      cwLogWarning("'%s' has no baseline.",cwStringNullGuard(r.label));
+      continue;
+    }
+
+    double p99_pct  = _change_pct(base->cycle_us.p99,r.cycle_us.p99);
+    double init_pct = _change_pct(base->init_ms,r.init_ms);
+    bool   fail_fl  = p99_pct > b.p99_thresh_pct || init_pct > b.init_thresh_pct;
+
+    cwLogInfo("%-24s %10.1f %10.1f %7.1f%% %10.2f %10.2f %7.1f%% %8i %s",cwStringNullGuard(r.label),
+              base->cycle_us.p99, r.cycle_us.p99, p99_pct,
+              base->init_ms, r.init_ms, init_pct,
+              r.peak_rss_rise_kb, fail_fl ? "FAIL" : "pass");
+
+    if( fail_fl )
+      rc = kTestFailRC;
+  }
+
+  if( rc != kOkRC )
+    rc = cwLogError(rc,"The benchmark regressed relative to the baseline '%s'.",b.baseline_fname.c_str());
+
+  return rc;
+}
+
+void _print_results( const bench_t& b )
+{
+  cwLogInfo("srate:%.0f dspFrameCnt:%i budget:%.1f us cycles:%i",b.srate,b.dspFrameCnt,b.budget_us,b.cycle_cnt);
+  cwLogInfo("%-24s %10s %10s %10s %10s %10s %10s %8s","program","load ms","init ms","p50 us","p99 us","max us","rss+ kB","over");
+
+  for(unsigned i=0; i<b.resultN; ++i)
+  {
+    const result_t& r = b.resultA[i];
+    cwLogInfo("%-24s %10.2f %10.2f %10.1f %10.1f %10.1f %10i %8i%s",cwStringNullGuard(r.label),
+              r.load_ms, r.init_ms, r.cycle_us.p50, r.cycle_us.p99, r.cycle_us.max, r.rss_rise_kb, r.over_budget_cnt,
+              r.rc == kOkRC ? "" : " (failed)");
+  }
+}
+
+int main( int argc, char* argv[] )
+{
+  rc_t                  rc        = kOkRC;
+  bench_t               b         = {};
+  const char*           pgm_label = nullptr;
+  io_flow_ctl::handle_t ioFlowH;
+  unsigned              pgmN      = 0;
+  log::log_args_t       log_args  = {};
+
+  log::init_minimum_args(log_args);
+  log::createGlobal(log_args);
+
+  if((rc = _parse_cfg(b,argc,argv,pgm_label)) != kOkRC )
+    goto errLabel;
+
+  if((rc = create( b.ioH, b.io_cfg, _io_callback, &b, nullptr, 0, nullptr )) != kOkRC )
+  {
+    rc = cwLogError(rc,"IO Framework instantiation failed.");
+    goto errLabel;
+  }
+
+  // get the program list
+  if((rc = create( ioFlowH, b.ioH, b.flow_cfg)) != kOkRC )
+  {
+    rc = cwLogError(rc,"IO-Flow instantiation failed.");
+    goto errLabel;
+  }
+
+  pgmN        = program_count(ioFlowH);
+  b.resultA   = mem::allocZ<result_t>(pgmN);
+  b.cycle_usA = mem::allocZ<double>(b.cycle_cnt);
+
+  for(unsigned i=0; i<pgmN; ++i)
+  {
+    const char* title = program_title(ioFlowH,i);
+
+    if( textIsEqual(pgm_label,"all") || textIsEqual(pgm_label,title) )
+    {
+      cwLogInfo("Benchmarking '%s' ...",cwStringNullGuard(title));
+
+      // a failed program is recorded in the results - continue with the next program
+      _run_program(b,i,b.resultA[ b.resultN++ ]);
+    }
+  }
+
+  destroy(ioFlowH);
+
+  if( b.resultN == 0 )
+  {
+    rc = cwLogError(kInvalidArgRC,"The program '%s' was not found in '%s'.",cwStringNullGuard(pgm_label),cwStringNullGuard(b.cfg_fname));
+    goto errLabel;
+  }
+
+  _print_results(b);
+
+  if((rc = _read_baseline(b)) != kOkRC )
+    goto errLabel;
+
+  switch( b.modeId )
+  {
+    case kGenBaselineModeId:
+      if((rc = _write_json(b,b.baseline_fname.c_str(),b.baseA,b.baseN)) != kOkRC )
+        goto errLabel;
+
+      cwLogInfo("Baseline written to '%s'.",b.baseline_fname.c_str());
+      break;
+
+    case kCompareModeId:
+      if((rc = _write_json(b,b.out_fname,nullptr,0)) != kOkRC )
+        goto errLabel;
+
+      rc = _compare_baseline(b);
+      break;
+
+    default:
+      if((rc = _write_json(b,b.out_fname,nullptr,0)) != kOkRC )
+        goto errLabel;
+  }
+
+  // a failed program fails the run (non-zero exit code)
+  for(unsigned i=0; i<b.resultN && rc == kOkRC; ++i)
+    if( b.resultA[i].rc != kOkRC )
+      rc = cwLogError(kTestFailRC,"The program '%s' failed.",cwStringNullGuard(b.resultA[i].label));
+
+errLabel:
+  for(unsigned i=0; i<b.resultN; ++i)
+    mem::release(b.resultA[i].label);
+
+  for(unsigned i=0; i<b.baseN; ++i)
+    mem::release(b.baseA[i].label);
+
+  mem::release(b.resultA);
+  mem::release(b.baseA);
+  mem::release(b.cycle_usA);
+  mem::release(b.sampleA);
+  mem::release(b.iChA);
+  mem::release(b.oChA);
+
+  destroy(b.ioH);
+
+  if( b.io_cfg != nullptr )
+    b.io_cfg->free();
+
+  if( b.flow_cfg != nullptr )
+    b.flow_cfg->free();
+
+  if( b.baseline_cfg != nullptr )
+    b.baseline_cfg->free();
+
+  log::destroyGlobal();
+
+  return rc;
+}
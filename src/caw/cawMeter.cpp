@@ -0,0 +1,394 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#include "cwCommon.h"
+#include "cwLog.h"
+#include "cwCommonImpl.h"
+#include "cwMem.h"
+#include "cwObject.h"
+#include "cwTime.h"
+#include "cwMidiDecls.h"
+#include "cwIo.h"
+
+#include "cawUiDecl.h"
+#include "cawUiSend.h"
+#include "cawMeter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <pthread.h>
+
+using namespace cw;
+
+namespace caw {
+
+  namespace meter {
+
+    typedef struct bank_str
+    {
+      float*   peakA;   // peakA[ maxChN ] max. absolute sample value
+      double*  sumSqA;  // sumSqA[ maxChN ] sum of squared samples
+      unsigned frmN;    // count of frames accumulated into sumSqA[]
+    } bank_t;
+
+    typedef struct chan_str
+    {
+      unsigned uuId;      // meter widget
+      double   hold_db;   // displayed value
+      double   hold_ms;   // time remaining before the displayed value decays
+      double   rms_db;    // RMS level of the last period
+      int      sent_px;   // last value sent to the UI in pixels or -1 if the value must be sent
+    } chan_t;
+
+    typedef struct meter_str
+    {
+      io::handle_t          ioH;
+      ui_send::handle_t     uiSendH;
+      args_t                args;
+
+      bank_t                bankA[2];
+      std::atomic<unsigned> writeIdx;  // bank written by the audio thread (set by the UI thread)
+      std::atomic<unsigned> ackIdx;    // bank the audio thread wrote to during its last cycle
+      std::atomic<unsigned> iChN;      // channel counts reported by the audio thread
+      std::atomic<unsigned> oChN;      //
+      bool                  swapFl;    // true if the banks were swapped and the UI is waiting for the ack
+
+      std::atomic<unsigned long>      writerId;     // pthread_self() of the audio thread which owns the banks (0 until the first write())
+      std::atomic<unsigned long long> foreignCnt;   // count of write() calls from other threads which were ignored
+      bool                            foreignLogFl; // the foreign writes were logged
+
+      chan_t*               chanA;     // chanA[ chanN ]
+      unsigned              chanN;     // count of meter widgets
+      unsigned              iChanN;    // count of input channel meter widgets
+
+      time::spec_t          t0;        // time of the last update
+      unsigned              cur_period_ms;
+      unsigned              backoff;   // period multiplier applied while the UI output is congested
+
+      unsigned long long    update_cnt;
+      unsigned long long    send_cnt;
+      unsigned long long    skip_cnt;  // count of meter values not sent because they did not change by a pixel
+    } meter_t;
+
+    meter_t* _handleToPtr( handle_t h )
+    { return handleToPtr<handle_t,meter_t>(h); }
+
+    rc_t _destroy( meter_t*& p )
+    {
+      if( p != nullptr )
+      {
+        for(unsigned i=0; i<2; ++i)
+        {
+          mem::release(p->bankA[i].peakA);
+          mem::release(p->bankA[i].sumSqA);
+        }
+        mem::release(p->chanA);
+        mem::release(p);
+      }
+      return kOkRC;
+    }
+
+    // Accumulate the peak and sum of squares of chN channels into the bank starting at channel 'ch0'.
+    void _accum( bank_t& b, unsigned ch0, unsigned maxChN, const float* const* chA, unsigned chN, unsigned frmN )
+    {
+      for(unsigned i=0; i<chN && ch0+i<maxChN; ++i)
+      {
+        const float* x   = chA[i];
+        float        pk  = b.peakA[ch0+i];
+        double       ss  = 0;
+
+        if( x == nullptr )
+          continue;
+
+        for(unsigned j=0; j<frmN; ++j)
+        {
+          float v = std::fabs(x[j]);
+          pk  = std::max(pk,v);
+          ss += (double)x[j]*x[j];
+        }
+
+        b.peakA[ch0+i]   = pk;
+        b.sumSqA[ch0+i] += ss;
+      }
+    }
+
+    rc_t _create_widgets( meter_t* p, unsigned iChN, unsigned oChN )
+    {
+      rc_t     rc         = kOkRC;
+      unsigned parentUuId = io::uiFindElementUuId( p->ioH, ui::kMeterListId );
+
+      if( parentUuId == kInvalidId )
+        return rc;
+
+      p->iChanN = std::min(iChN,p->args.maxChCnt);
+      p->chanN  = std::min(iChN + oChN,p->args.maxChCnt);
+      p->chanA  = mem::allocZ<chan_t>(p->chanN);
+
+      for(unsigned i=0; i<p->chanN; ++i)
+      {
+        char     title[32];
+        bool     in_fl = i < p->iChanN;
+        chan_t*  c     = p->chanA + i;
+
+        snprintf(title,sizeof(title),"%s %i",in_fl ? "in" : "out",in_fl ? i : i-p->iChanN);
+
+        c->hold_db = p->args.min_db;
+        c->rms_db  = p->args.min_db;
+        c->sent_px = -1;
+
+        if((rc = uiCreateProg(p->ioH, c->uuId, parentUuId, nullptr, ui::kDevMeterId, i, nullptr, title, p->args.min_db, p->args.max_db )) != kOkRC )
+        {
+          rc = cwLogError(rc,"The device meter widget '%s' could not be created.",title);
+          goto errLabel;
+        }
+      }
+
+      cwLogInfo("%i device meters created (%i in, %i out).",p->chanN,p->iChanN,p->chanN-p->iChanN);
+
+    errLabel:
+      return rc;
+    }
+
+    // Convert the completed bank to dB, apply the peak-hold/decay and send the changed meters.
+    rc_t _update( meter_t* p, bank_t& b, double dt_ms )
+    {
+      rc_t   rc        = kOkRC;
+      double px_per_db = p->args.pixelN / (p->args.max_db - p->args.min_db);
+
+      for(unsigned i=0; i<p->chanN; ++i)
+      {
+        chan_t* c       = p->chanA + i;
+        double  peak_db = 20.0 * std::log10( std::max((double)b.peakA[i],1e-10) );
+
+        c->rms_db = b.frmN==0 ? p->args.min_db : std::max(p->args.min_db, 10.0 * std::log10( std::max(b.sumSqA[i]/b.frmN,1e-20) ));
+
+        if( peak_db >= c->hold_db )
+        {
+          c->hold_db = peak_db;
+          c->hold_ms = p->args.hold_ms;
+        }
+        else
+        {
+          if( c->hold_ms > 0 )
+            c->hold_ms -= dt_ms;
+          else
+            c->hold_db = std::max(std::max(peak_db,p->args.min_db), c->hold_db - p->args.decay_db_per_sec * dt_ms / 1000.0 );
+        }
+
+        double db = std::min(std::max(c->hold_db,p->args.min_db),p->args.max_db);
+        int    px = (int)std::lround( (db - p->args.min_db) * px_per_db );
+
+        if( px == c->sent_px )
+        {
+          p->skip_cnt += 1;
+          continue;
+        }
+
+        if((rc = ui_send::value( p->uiSendH, c->uuId, db )) != kOkRC )
+        {
+          rc = cwLogError(rc,"Meter update failed.");
+          break;
+        }
+
+        c->sent_px   = px;
+        p->send_cnt += 1;
+      }
+
+      // back off while the UI output is congested
+      if( ui_send::is_congested(p->uiSendH) )
+        p->backoff = std::min(p->backoff*2, std::max(1u,p->args.max_period_ms/std::max(1u,p->args.period_ms)));
+      else
+        if( p->backoff > 1 )
+          p->backoff /= 2;
+
+      p->update_cnt += 1;
+
+      return rc;
+    }
+
+    // The period needed to keep chanN meters within the message budget - increased by the current back off.
+    unsigned _calc_period_ms( const meter_t* p )
+    {
+      unsigned budget_ms = p->args.max_msg_per_sec==0 ? 0 : (p->chanN * 1000) / p->args.max_msg_per_sec;
+      unsigned period_ms = std::max(p->args.period_ms,budget_ms) * p->backoff;
+
+      return std::min(period_ms,std::max(p->args.period_ms,p->args.max_period_ms));
+    }
+  }
+}
+
+void caw::meter::default_args( args_t& args )
+{
+  args.maxChCnt         = 64;
+  args.period_ms        = 50;
+  args.max_period_ms    = 500;
+  args.max_msg_per_sec  = 400;
+  args.min_db           = -100;
+  args.max_db           = 0;
+  args.pixelN           = 100;
+  args.hold_ms          = 1500;
+  args.decay_db_per_sec = 20;
+}
+
+cw::rc_t caw::meter::create( handle_t& hRef, io::handle_t ioH, ui_send::handle_t uiSendH, const args_t& args )
+{
+  rc_t     rc;
+  meter_t* p = nullptr;
+
+  if((rc = destroy(hRef)) != kOkRC )
+    return rc;
+
+  if( args.maxChCnt == 0 || args.pixelN == 0 || args.max_db <= args.min_db )
+    return cwLogError(kInvalidArgRC,"The meter channel count, pixel count and dB range must be non-zero.");
+
+  p                = mem::allocZ<meter_t>();
+  p->ioH           = ioH;
+  p->uiSendH       = uiSendH;
+  p->args          = args;
+  p->backoff       = 1;
+  p->cur_period_ms = args.period_ms;
+
+  for(unsigned i=0; i<2; ++i)
+  {
+    p->bankA[i].peakA  = mem::allocZ<float>(args.maxChCnt);
+    p->bankA[i].sumSqA = mem::allocZ<double>(args.maxChCnt);
+  }
+
+  time::get(p->t0);
+
+  hRef.set(p);
+
+  return rc;
+}
+
+cw::rc_t caw::meter::destroy( handle_t& hRef )
+{
+  rc_t rc = kOkRC;
+
+  if( !hRef.isValid() )
+    return rc;
+
+  meter_t* p = _handleToPtr(hRef);
+
+  if((rc = _destroy(p)) != kOkRC )
+    return cwLogError(rc,"Meter destroy failed.");
+
+  hRef.clear();
+
+  return rc;
+}
+
+void caw::meter::write( handle_t h, const float* const* iChA, unsigned iChN, const float* const* oChA, unsigned oChN, unsigned frmN )
+{
+  if( !h.isValid() )
+    return;
+
+  meter_t*      p    = _handleToPtr(h);
+  unsigned long self = (unsigned long)pthread_self();
+  unsigned long id   = 0;
+
+  // The bank swap handshake assumes a single writer. The first thread to call write()
+  // owns the banks and calls from other audio threads (e.g. a second audio group) are dropped.
+  if( !p->writerId.compare_exchange_strong(id,self,std::memory_order_relaxed) && id != self )
+  {
+    p->foreignCnt.fetch_add(1,std::memory_order_relaxed);
+    return;
+  }
+
+  unsigned bIdx = p->writeIdx.load(std::memory_order_acquire);
+  bank_t&  b    = p->bankA[ bIdx ];
+
+  _accum(b, 0,    p->args.maxChCnt, iChA, iChN, frmN );
+  _accum(b, iChN, p->args.maxChCnt, oChA, oChN, frmN );
+  b.frmN += frmN;
+
+  p->iChN.store(iChN,std::memory_order_relaxed);
+  p->oChN.store(oChN,std::memory_order_relaxed);
+
+  // tell the UI thread that this cycle went to 'bIdx' - the other bank is not in use
+  p->ackIdx.store(bIdx,std::memory_order_release);
+}
+
+cw::rc_t caw::meter::exec( handle_t h )
+{
+  rc_t rc = kOkRC;
+
+  if( !h.isValid() )
+    return rc;
+
+  meter_t*     p = _handleToPtr(h);
+  time::spec_t now;
+
+  time::get(now);
+
+  unsigned     wIdx   = p->writeIdx.load(std::memory_order_relaxed);
+  double       dt_ms  = time::elapsedMicros(p->t0,now) / 1000.0;
+
+  if( !p->foreignLogFl && p->foreignCnt.load(std::memory_order_relaxed) > 0 )
+  {
+    cwLogWarning("Meters: write() was called from more than one audio thread. Only the first thread's channels are metered.");
+    p->foreignLogFl = true;
+  }
+
+  if( !p->swapFl )
+  {
+    if( dt_ms < p->cur_period_ms )
+      return rc;
+
+    // direct the audio thread to the other (cleared) bank
+    p->writeIdx.store(1-wIdx,std::memory_order_release);
+    p->swapFl = true;
+    return rc;
+  }
+
+  // wait until the audio thread has completed a cycle using the new bank
+  if( p->ackIdx.load(std::memory_order_acquire) != wIdx )
+    return rc;
+
+  p->swapFl = false;
+  p->t0     = now;
+
+  bank_t& b = p->bankA[ 1-wIdx ];
+
+  if( p->chanA == nullptr && b.frmN > 0 )
+    rc = _create_widgets(p, p->iChN.load(std::memory_order_relaxed), p->oChN.load(std::memory_order_relaxed));
+
+  if( p->chanA != nullptr && rc == kOkRC )
+  {
+    rc               = _update(p,b,dt_ms);
+    p->cur_period_ms = _calc_period_ms(p);
+  }
+
+  // clear the bank before it is given back to the audio thread
+  std::fill(b.peakA,  b.peakA  + p->args.maxChCnt, 0.0f);
+  std::fill(b.sumSqA, b.sumSqA + p->args.maxChCnt, 0.0);
+  b.frmN = 0;
+
+  return rc;
+}
+
+void caw::meter::invalidate( handle_t h )
+{
+  if( !h.isValid() )
+    return;
+
+  meter_t* p = _handleToPtr(h);
+
+  for(unsigned i=0; i<p->chanN; ++i)
+    p->chanA[i].sent_px = -1;
+}
+
+void caw::meter::report( handle_t h )
+{
+  if( !h.isValid() )
+    return;
+
+  meter_t* p = _handleToPtr(h);
+
+  cwLogInfo("Meters: %i period:%i ms backoff:%i updates:%llu sent:%llu unchanged:%llu ignored writes:%llu",
+            p->chanN, p->cur_period_ms, p->backoff, p->update_cnt, p->send_cnt, p->skip_cnt, p->foreignCnt.load() );
+
+  for(unsigned i=0; i<p->chanN; ++i)
+    cwLogInfo("  %s %2i peak:%6.1f dB rms:%6.1f dB",
+              i < p->iChanN ? "in " : "out", i < p->iChanN ? i : i-p->iChanN, p->chanA[i].hold_db, p->chanA[i].rms_db );
+}
@@ -0,0 +1,63 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#ifndef cawMeter_h
+#define cawMeter_h
+
+// Audio device channel meters.
+//
+// The audio thread only accumulates the raw per-channel peak and sum of squares
+// with write(). The accumulators are double buffered: the UI thread swaps the
+// buffers with exec() and, once the audio thread has moved to the other buffer,
+// converts the completed buffer to dB and applies the peak-hold and decay.
+// The handshake assumes that exactly one audio thread calls write(). The first
+// thread to call it owns the meters. Calls from any other thread (e.g. the callback
+// of a second audio group) are counted and ignored.
+// A meter is only sent to the UI when its displayed value moved by at least one
+// pixel (one step of the UI progress bar).
+//
+// The update period grows with the count of meters, so that the count of meter
+// messages per second stays within 'max_msg_per_sec', and backs off while the
+// ui_send queue reports congestion (websocket backpressure or a lagging session).
+// The values are sent through ui_send so a superseded meter value is never sent.
+
+namespace caw
+{
+  namespace meter
+  {
+    typedef cw::handle<struct meter_str> handle_t;
+
+    typedef struct args_str
+    {
+      unsigned maxChCnt;          // max. count of metered channels (inputs + outputs)
+      unsigned period_ms;         // update period when few meters are shown
+      unsigned max_period_ms;     // slowest update period under load
+      unsigned max_msg_per_sec;   // meter update message budget
+      double   min_db;            // meter range
+      double   max_db;            //
+      unsigned pixelN;            // count of steps in the UI meter (ui.js progress 'max')
+      unsigned hold_ms;           // peak-hold time
+      double   decay_db_per_sec;  // fall rate once the hold time has expired
+    } args_t;
+
+    // Set the default arguments.
+    void default_args( args_t& args );
+
+    cw::rc_t create( handle_t& hRef, cw::io::handle_t ioH, ui_send::handle_t uiSendH, const args_t& args );
+    cw::rc_t destroy( handle_t& hRef );
+
+    // Called from the audio thread. Only the first thread to call write() is metered.
+    void write( handle_t h, const float* const* iChA, unsigned iChN, const float* const* oChA, unsigned oChN, unsigned frmN );
+
+    // Called from the UI thread. Create the meter widgets once the channel count
+    // is known and send the meters whose displayed value changed.
+    cw::rc_t exec( handle_t h );
+
+    // Resend all meters on the next update (e.g. a new UI session connected).
+    void invalidate( handle_t h );
+
+    // Print the current levels and the update rate statistics.
+    void report( handle_t h );
+  }
+}
+
+#endif
@@ -0,0 +1,288 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#include "cwCommon.h"
+#include "cwLog.h"
+#include "cwCommonImpl.h"
+#include "cwMem.h"
+#include "cwFileSys.h"
+#include "cwTime.h"
+#include "cwMidiDecls.h"
+
+#include "cawMidiQueue.h"
+#include "cawMetrics.h"
+#include "cawPerf.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+
+using namespace cw;
+
+namespace caw {
+
+  namespace metrics {
+
+    typedef unsigned long long u64_t;
+
+    enum {
+      kBinUs = 10,    // histogram bin width in microseconds
+      kBinCnt = 2000  // bins cover 0 to 20ms - longer callbacks fall in the last bin
+    };
+
+    typedef struct metrics_str
+    {
+      char*                 fname;       // output file
+      char*                 tmp_fname;   // output is written here and then renamed to 'fname'
+      unsigned              fmtId;
+      unsigned              period_ms;
+      time::spec_t          t0;          // creation time
+      time::spec_t          last_write;  //
+
+      // written by the audio thread
+      std::atomic<u64_t>    binA[ kBinCnt ];  // callback duration histogram
+      std::atomic<u64_t>    cycle_cnt;
+      std::atomic<u64_t>    cycle_sum_ns;
+      std::atomic<u64_t>    period_max_ns;    // max. callback duration since the last write
+      std::atomic<u64_t>    miss_cnt;         // count of callbacks which overran their budget
+      std::atomic<u64_t>    budget_ns;        // most recent callback budget
+
+      // log lines may be output from any thread
+      std::atomic<u64_t>    ui_msg_cnt;
+      std::atomic<u64_t>    log_line_cnt;
+
+      u64_t                 prevBinA[ kBinCnt ]; // binA[] at the previous write
+    } metrics_t;
+
+    metrics_t* _handleToPtr( handle_t h )
+    { return handleToPtr<handle_t,metrics_t>(h); }
+
+    rc_t _destroy( metrics_t*& p )
+    {
+      if( p != nullptr )
+      {
+        mem::release(p->fname);
+        mem::release(p->tmp_fname);
+        mem::release(p);
+      }
+      return kOkRC;
+    }
+
+    // Nearest-rank percentile in microseconds of the callbacks counted by the histogram deltaA[].
+    double _percentile( const u64_t* deltaA, u64_t n, double pct )
+    {
+      u64_t rank = (u64_t)std::max(1.0,std::ceil(pct * n / 100.0 - 1e-9)) - 1;
+      u64_t sum  = 0;
+
+      for(unsigned i=0; i<kBinCnt; ++i)
+      {
+        sum += deltaA[i];
+        if( sum > rank )
+          return (i+1) * kBinUs;  // upper edge of the bin
+      }
+
+      return kBinCnt * kBinUs;
+    }
+
+    void _write_prom( FILE* fp, const char* name, const char* type, const char* help, double value )
+    {
+      fprintf(fp,"# HELP %s %s\n# TYPE %s %s\n%s %.15g\n",name,help,name,type,name,value);
+    }
+
+    rc_t _write( metrics_t* p, midi_queue::handle_t midiQueueH )
+    {
+      rc_t               rc       = kOkRC;
+      u64_t              deltaA[ kBinCnt ];
+      u64_t              n        = 0;
+      double             pctA[]   = { 50, 90, 99, 99.9 };
+      const char*        qLabelA[]= { "0.5", "0.9", "0.99", "0.999" };
+      double             qA[4];
+      midi_queue::usage_t mu      = {};
+      time::spec_t       now;
+      FILE*              fp;
+
+      time::get(now);
+
+      // callback duration distribution over the last period
+      for(unsigned i=0; i<kBinCnt; ++i)
+      {
+        u64_t c       = p->binA[i].load(std::memory_order_relaxed);
+        deltaA[i]     = c - p->prevBinA[i];
+        p->prevBinA[i] = c;
+        n            += deltaA[i];
+      }
+
+      for(unsigned i=0; i<4; ++i)
+        qA[i] = n==0 ? 0 : _percentile(deltaA,n,pctA[i]);
+
+      double max_us     = p->period_max_ns.exchange(0,std::memory_order_relaxed) / 1000.0;
+      double budget_us  = p->budget_ns.load(std::memory_order_relaxed) / 1000.0;
+      u64_t  cycle_cnt  = p->cycle_cnt.load(std::memory_order_relaxed);
+      double cycle_sum  = p->cycle_sum_ns.load(std::memory_order_relaxed) / 1000.0;
+      u64_t  miss_cnt   = p->miss_cnt.load(std::memory_order_relaxed);
+      double uptime_sec = time::elapsedMicros(p->t0,now) / 1000000.0;
+
+      if( midiQueueH.isValid() )
+        midi_queue::usage(midiQueueH,mu);
+
+      if((fp = fopen(p->tmp_fname,"w")) == nullptr )
+        return cwLogError(kOpenFailRC,"The metrics file '%s' could not be created.",cwStringNullGuard(p->tmp_fname));
+
+      if( p->fmtId == kJsonFmtId )
+      {
+        fprintf(fp,"{\n");
+        fprintf(fp,"  \"uptime_sec\": %.3f,\n",uptime_sec);
+        fprintf(fp,"  \"audio\": { \"budget_us\":%.3f, \"cycle_cnt\":%llu, \"cycle_sum_us\":%.3f, \"deadline_miss_cnt\":%llu,\n",budget_us,cycle_cnt,cycle_sum,miss_cnt);
+        fprintf(fp,"             \"period_cycle_cnt\":%llu, \"p50_us\":%.1f, \"p90_us\":%.1f, \"p99_us\":%.1f, \"p999_us\":%.1f, \"max_us\":%.3f },\n",n,qA[0],qA[1],qA[2],qA[3],max_us);
+        fprintf(fp,"  \"ui\": { \"msg_cnt\":%llu },\n",p->ui_msg_cnt.load());
+        fprintf(fp,"  \"log\": { \"line_cnt\":%llu },\n",p->log_line_cnt.load());
+        fprintf(fp,"  \"midi\": { \"queue_capacity\":%u, \"max_depth\":%llu, \"msg_cnt\":%llu, \"overflow_cnt\":%llu, \"late_cnt\":%llu, \"wait_mean_us\":%.1f, \"wait_max_us\":%llu },\n",
+                mu.capacity, mu.max_depth, mu.msg_cnt, mu.overflow_cnt, mu.late_cnt, mu.wait_mean_us, mu.wait_max_us);
+        fprintf(fp,"  \"memory\": { \"rss_kb\":%u, \"peak_rss_kb\":%u }\n",perf::current_rss_kb(),perf::peak_rss_kb());
+        fprintf(fp,"}\n");
+      }
+      else
+      {
+        fprintf(fp,"# HELP caw_audio_cycle_us Audio callback duration over the last period.\n# TYPE caw_audio_cycle_us summary\n");
+        for(unsigned i=0; i<4; ++i)
+          fprintf(fp,"caw_audio_cycle_us{quantile=\"%s\"} %.1f\n",qLabelA[i],qA[i]);
+        fprintf(fp,"caw_audio_cycle_us_sum %.3f\ncaw_audio_cycle_us_count %llu\n",cycle_sum,cycle_cnt);
+
+        _write_prom(fp,"caw_uptime_seconds",             "gauge",  "Time since the metrics were started.",                   uptime_sec);
+        _write_prom(fp,"caw_audio_cycle_max_us",         "gauge",  "Longest audio callback over the last period.",           max_us);
+        _write_prom(fp,"caw_audio_budget_us",            "gauge",  "Duration of one audio block.",                           budget_us);
+        _write_prom(fp,"caw_audio_deadline_miss_total",  "counter","Audio callbacks which took longer than the block duration.", miss_cnt);
+        _write_prom(fp,"caw_ui_msg_total",               "counter","UI messages handled.",                                   p->ui_msg_cnt.load());
+        _write_prom(fp,"caw_log_line_total",             "counter","Log lines output.",                                      p->log_line_cnt.load());
+        _write_prom(fp,"caw_midi_queue_capacity",        "gauge",  "MIDI input queue size in messages.",                    mu.capacity);
+        _write_prom(fp,"caw_midi_queue_max_depth",       "gauge",  "Max. count of MIDI messages queued during one cycle.",  mu.max_depth);
+        _write_prom(fp,"caw_midi_msg_total",             "counter","MIDI messages collected from the input queue.",         mu.msg_cnt);
+        _write_prom(fp,"caw_midi_overflow_total",        "counter","MIDI messages dropped because the queue was full.",     mu.overflow_cnt);
+        _write_prom(fp,"caw_midi_late_total",            "counter","MIDI messages whose cycle offset was clamped.",         mu.late_cnt);
+        _write_prom(fp,"caw_midi_queue_wait_mean_us",    "gauge",  "Mean MIDI wait from arrival to cycle collection.",      mu.wait_mean_us);
+        _write_prom(fp,"caw_midi_queue_wait_max_us",     "gauge",  "Max. MIDI wait from arrival to cycle collection.",      mu.wait_max_us);
+        _write_prom(fp,"caw_rss_kb",                     "gauge",  "Resident set size.",                                    perf::current_rss_kb());
+        _write_prom(fp,"caw_peak_rss_kb",                "gauge",  "Peak resident set size.",                               perf::peak_rss_kb());
+      }
+
+      fclose(fp);
+
+      if( rename(p->tmp_fname,p->fname) != 0 )
+        rc = cwLogError(kOpFailRC,"The metrics file '%s' could not be renamed to '%s'.",p->tmp_fname,p->fname);
+
+      return rc;
+    }
+  }
+}
+
+cw::rc_t caw::metrics::create( handle_t& hRef, const char* dir, const char* fname, unsigned fmtId, unsigned period_ms )
+{
+  rc_t       rc;
+  metrics_t* p       = nullptr;
+  char*      exp_dir = nullptr;
+
+  if((rc = destroy(hRef)) != kOkRC )
+    return rc;
+
+  if( dir == nullptr || fname == nullptr )
+    return cwLogError(kInvalidArgRC,"The metrics directory and file name must be given.");
+
+  p            = mem::allocZ<metrics_t>();
+  p->fmtId     = fmtId;
+  p->period_ms = period_ms==0 ? 1000 : period_ms;
+
+  exp_dir      = filesys::expandPath(dir);
+  p->fname     = filesys::makeFn(exp_dir,fname,nullptr,nullptr);
+  p->tmp_fname = filesys::makeFn(exp_dir,fname,"tmp",nullptr);
+
+  mem::release(exp_dir);
+
+  if( p->fname == nullptr || p->tmp_fname == nullptr )
+  {
+    rc = cwLogError(kOpFailRC,"The metrics file name could not be formed from '%s' and '%s'.",dir,fname);
+    _destroy(p);
+    goto errLabel;
+  }
+
+  time::get(p->t0);
+  p->last_write = p->t0;
+
+  cwLogInfo("Metrics will be written to '%s' every %i ms.",p->fname,p->period_ms);
+
+  hRef.set(p);
+
+errLabel:
+  return rc;
+}
+
+cw::rc_t caw::metrics::destroy( handle_t& hRef )
+{
+  rc_t rc = kOkRC;
+
+  if( !hRef.isValid() )
+    return rc;
+
+  metrics_t* p = _handleToPtr(hRef);
+
+  if((rc = _destroy(p)) != kOkRC )
+    return cwLogError(rc,"Metrics destroy failed.");
+
+  hRef.clear();
+
+  return rc;
+}
+
+void caw::metrics::cycle( handle_t h, const cw::time::spec_t& t0, double budget_us )
+{
+  if( !h.isValid() )
+    return;
+
+  metrics_t*   p = _handleToPtr(h);
+  time::spec_t t1;
+
+  time::get(t1);
+
+  u64_t ns  = (u64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ull + t1.tv_nsec - t0.tv_nsec;
+  u64_t bin = ns / (kBinUs*1000);
+
+  p->binA[ bin < kBinCnt ? bin : kBinCnt-1 ].fetch_add(1,std::memory_order_relaxed);
+  p->cycle_cnt.fetch_add(1,std::memory_order_relaxed);
+  p->cycle_sum_ns.fetch_add(ns,std::memory_order_relaxed);
+  p->budget_ns.store((u64_t)(budget_us*1000),std::memory_order_relaxed);
+
+  if( ns > p->period_max_ns.load(std::memory_order_relaxed) )
+    p->period_max_ns.store(ns,std::memory_order_relaxed);
+
+  if( budget_us > 0 && ns > budget_us*1000 )
+    p->miss_cnt.fetch_add(1,std::memory_order_relaxed);
+}
+
+void caw::metrics::ui_msg( handle_t h )
+{
+  if( h.isValid() )
+    _handleToPtr(h)->ui_msg_cnt.fetch_add(1,std::memory_order_relaxed);
+}
+
+void caw::metrics::log_line( handle_t h )
+{
+  if( h.isValid() )
+    _handleToPtr(h)->log_line_cnt.fetch_add(1,std::memory_order_relaxed);
+}
+
+cw::rc_t caw::metrics::exec( handle_t h, midi_queue::handle_t midiQueueH )
+{
+  if( !h.isValid() )
+    return kOkRC;
+
+  metrics_t*   p = _handleToPtr(h);
+  time::spec_t now;
+
+  time::get(now);
+
+  if( time::elapsedMicros(p->last_write,now) < p->period_ms * 1000ull )
+    return kOkRC;
+
+  p->last_write = now;
+
+  return _write(p,midiQueueH);
+}
@@ -0,0 +1,43 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#ifndef cawMetrics_h
+#define cawMetrics_h
+
+// Runtime metrics published as a file in the UI HTTP server root directory.
+//
+// The audio thread reports the duration of each callback with cycle(). The main
+// thread calls exec() periodically which, once per 'period_ms', writes the callback
+// duration percentiles of the last period, the deadline miss count, the UI message
+// and log line counts, the MIDI input queue usage and the process memory use to
+// '<physRootDir>/<fname>'. Monitoring can then scrape http://<host>:<port>/<fname>.
+//
+// The file is written to a temporary file and renamed so that readers never see a
+// partially written document.
+
+namespace caw
+{
+  namespace metrics
+  {
+    typedef cw::handle<struct metrics_str> handle_t;
+
+    enum {
+      kPromFmtId,  // Prometheus text exposition format
+      kJsonFmtId
+    };
+
+    cw::rc_t create( handle_t& hRef, const char* dir, const char* fname, unsigned fmtId, unsigned period_ms );
+    cw::rc_t destroy( handle_t& hRef );
+
+    // Called from the audio thread at the end of each callback.
+    void cycle( handle_t h, const cw::time::spec_t& t0, double budget_us );
+
+    // Count a handled UI message or an output log line. (Any thread).
+    void ui_msg( handle_t h );
+    void log_line( handle_t h );
+
+    // Called from the main thread. Write the metrics file if 'period_ms' has elapsed since the last write.
+    cw::rc_t exec( handle_t h, midi_queue::handle_t midiQueueH );
+  }
+}
+
+#endif
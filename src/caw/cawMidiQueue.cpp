@@ -0,0 +1,342 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#include "cwCommon.h"
+#include "cwLog.h"
+#include "cwCommonImpl.h"
+#include "cwMem.h"
+#include "cwTime.h"
+#include "cwMidiDecls.h"
+
+#include "cawMidiQueue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+using namespace cw;
+
+namespace caw {
+
+  namespace midi_queue {
+
+    typedef unsigned long long u64_t;
+
+    typedef struct stats_str
+    {
+      // totals - never reset
+      std::atomic<u64_t> msg_cnt;        // count of collected messages
+      std::atomic<u64_t> overflow_cnt;   // count of messages dropped because the queue was full
+      std::atomic<u64_t> late_cnt;       // count of messages whose offset was clamped to the end of the cycle
+
+      // restarted by reset_stats()
+      std::atomic<u64_t> stat_cnt;       // count of collected messages since the last reset
+      std::atomic<u64_t> max_depth;      // max. count of messages collected in one cycle
+      std::atomic<u64_t> wait_min_us;    // time from arrival to collection by exec_cycle()
+      std::atomic<u64_t> wait_max_us;    //
+      std::atomic<u64_t> wait_sum_us;    //
+      std::atomic<u64_t> wait_sum_sq_us; //
+      std::atomic<u64_t> offs_sum;       // sum of the sub-block frame offsets
+      std::atomic<u64_t> offs_max;       //
+    } stats_t;
+
+    typedef struct midi_queue_str
+    {
+      msg_t*             ringA;     // ringA[ringN] SPSC ring
+      unsigned           ringN;     // power of two
+      std::atomic<u64_t> head;      // written by the producer (MIDI thread)
+      std::atomic<u64_t> tail;      // written by the consumer (audio thread)
+
+      msg_t*             cycleA;    // cycleA[ringN] messages collected by the current cycle
+
+      // frame clock published by the audio thread - read by the producer
+      std::atomic<unsigned> clock_seq;      // seqlock sequence (odd while being updated)
+      std::atomic<u64_t>    clock_frame;    // frame index at the start of the current cycle
+      std::atomic<u64_t>    clock_ns;       // time at the start of the current cycle
+      std::atomic<unsigned> clock_srate;    //
+
+      std::atomic<bool>     reset_stats_fl;
+      stats_t               stats;
+
+    } midi_queue_t;
+
+    midi_queue_t* _handleToPtr( handle_t h )
+    { return handleToPtr<handle_t,midi_queue_t>(h); }
+
+    u64_t _spec_to_ns( const time::spec_t& t )
+    { return (u64_t)t.tv_sec * 1000000000ull + (u64_t)t.tv_nsec; }
+
+    void _reset_stats( midi_queue_t* p )
+    {
+      p->stats.stat_cnt.store(0);
+      p->stats.max_depth.store(0);
+      p->stats.wait_min_us.store(~0ull);
+      p->stats.wait_max_us.store(0);
+      p->stats.wait_sum_us.store(0);
+      p->stats.wait_sum_sq_us.store(0);
+      p->stats.offs_sum.store(0);
+      p->stats.offs_max.store(0);
+    }
+
+    rc_t _destroy( midi_queue_t*& p )
+    {
+      rc_t rc = kOkRC;
+      if( p != nullptr )
+      {
+        mem::release(p->ringA);
+        mem::release(p->cycleA);
+        mem::release(p);
+      }
+      return rc;
+    }
+
+    // Read a consistent (frame,ns,srate) triple from the frame clock.
+    void _read_clock( midi_queue_t* p, u64_t& frame_ref, u64_t& ns_ref, unsigned& srate_ref )
+    {
+      unsigned seq0, seq1;
+      do
+      {
+        seq0      = p->clock_seq.load(std::memory_order_acquire);
+        frame_ref = p->clock_frame.load(std::memory_order_relaxed);
+        ns_ref    = p->clock_ns.load(std::memory_order_relaxed);
+        srate_ref = p->clock_srate.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq1      = p->clock_seq.load(std::memory_order_relaxed);
+      }while( (seq0 & 1) || seq0 != seq1 );
+    }
+
+    void _write_clock( midi_queue_t* p, u64_t frame, u64_t ns, unsigned srate )
+    {
+      unsigned seq = p->clock_seq.load(std::memory_order_relaxed);
+      p->clock_seq.store(seq+1,std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      p->clock_frame.store(frame,std::memory_order_relaxed);
+      p->clock_ns.store(ns,std::memory_order_relaxed);
+      p->clock_srate.store(srate,std::memory_order_relaxed);
+      p->clock_seq.store(seq+2,std::memory_order_release);
+    }
+
+    void _update_max( std::atomic<u64_t>& v, u64_t x )
+    {
+      if( x > v.load(std::memory_order_relaxed) )
+        v.store(x,std::memory_order_relaxed);
+    }
+  }
+}
+
+cw::rc_t caw::midi_queue::create( handle_t& hRef, unsigned msgCnt )
+{
+  rc_t          rc;
+  midi_queue_t* p = nullptr;
+
+  if((rc = destroy(hRef)) != kOkRC )
+    return rc;
+
+  p = mem::allocZ<midi_queue_t>();
+
+  // round the ring size up to a power of two
+  p->ringN = 16;
+  while( p->ringN < msgCnt )
+    p->ringN <<= 1;
+
+  p->ringA  = mem::allocZ<msg_t>(p->ringN);
+  p->cycleA = mem::allocZ<msg_t>(p->ringN);
+
+  _reset_stats(p);
+
+  hRef.set(p);
+
+  return rc;
+}
+
+cw::rc_t caw::midi_queue::destroy( handle_t& hRef )
+{
+  rc_t rc = kOkRC;
+
+  if( !hRef.isValid() )
+    return rc;
+
+  midi_queue_t* p = _handleToPtr(hRef);
+
+  if((rc = _destroy(p)) != kOkRC )
+  {
+    rc = cwLogError(rc,"MIDI queue destroy failed.");
+    goto errLabel;
+  }
+
+  hRef.clear();
+
+errLabel:
+  return rc;
+}
+
+cw::rc_t caw::midi_queue::push( handle_t h, const midi::packet_t* pkt )
+{
+  midi_queue_t* p = _handleToPtr(h);
+  u64_t         clock_frame;
+  u64_t         clock_ns;
+  unsigned      srate;
+  time::spec_t  now;
+
+  if( pkt == nullptr || pkt->msgArray == nullptr )
+    return kOkRC;
+
+  time::get(now);
+  _read_clock(p,clock_frame,clock_ns,srate);
+
+  u64_t head = p->head.load(std::memory_order_relaxed);
+  u64_t tail = p->tail.load(std::memory_order_acquire);
+
+  for(unsigned i=0; i<pkt->msgCnt; ++i)
+  {
+    const midi::ch_msg_t* m    = pkt->msgArray + i;
+    time::spec_t          ts   = m->timeStamp;
+    msg_t*                r    = nullptr;
+
+    // use the driver's arrival time - unless it is missing or ahead of the system clock
+    if( _spec_to_ns(ts) == 0 || _spec_to_ns(ts) > _spec_to_ns(now) )
+      ts = now;
+
+    u64_t ns = _spec_to_ns(ts);
+
+    if( head - tail >= p->ringN )
+    {
+      p->stats.overflow_cnt.fetch_add(1,std::memory_order_relaxed);
+      continue;
+    }
+
+    r = p->ringA + (head & (p->ringN-1));
+
+    // stamp the message with the audio frame clock
+    r->frame      = clock_frame;
+    if( srate > 0 && ns > clock_ns )
+      r->frame += ((ns - clock_ns) * srate) / 1000000000ull;
+
+    r->frame_offs = 0;
+    r->timestamp  = ts;
+    r->devIdx     = pkt->devIdx;
+    r->portIdx    = pkt->portIdx;
+    r->ch         = m->ch;
+    r->status     = m->status;
+    r->d0         = m->d0;
+    r->d1         = m->d1;
+
+    ++head;
+  }
+
+  p->head.store(head,std::memory_order_release);
+
+  return kOkRC;
+}
+
+unsigned caw::midi_queue::exec_cycle( handle_t h, double srate, unsigned frmN, const msg_t*& msgA_ref )
+{
+  midi_queue_t* p           = _handleToPtr(h);
+  u64_t         clock_frame = p->clock_frame.load(std::memory_order_relaxed);
+  u64_t         cycle_frame = clock_frame;  // start of the cycle in which the collected msgs arrived
+  unsigned      msgN        = 0;
+  time::spec_t  now;
+
+  time::get(now);
+
+  if( p->reset_stats_fl.exchange(false) )
+    _reset_stats(p);
+
+  // Advance the frame clock. Messages which arrive from now on are stamped relative to this cycle.
+  if( p->clock_ns.load(std::memory_order_relaxed) != 0 )
+    clock_frame += frmN;
+
+  _write_clock(p,clock_frame,_spec_to_ns(now),(unsigned)srate);
+
+  // Gather the messages which arrived during the previous cycle.
+  u64_t head = p->head.load(std::memory_order_acquire);
+  u64_t tail = p->tail.load(std::memory_order_relaxed);
+
+  for(; tail != head; ++tail)
+  {
+    const msg_t* r = p->ringA + (tail & (p->ringN-1));
+
+    // msgs stamped against the new clock arrived after this cycle started - they belong to the next cycle
+    if( clock_frame > cycle_frame && r->frame >= clock_frame )
+      break;
+
+    msg_t* m  = p->cycleA + msgN++;
+    *m        = *r;
+
+    u64_t offs    = m->frame > cycle_frame ? m->frame - cycle_frame : 0;
+    if( offs >= frmN )
+    {
+      offs = frmN - 1;
+      p->stats.late_cnt.fetch_add(1,std::memory_order_relaxed);
+    }
+
+    m->frame_offs = (unsigned)offs;
+
+    u64_t wait_us = time::elapsedMicros(m->timestamp,now);
+
+    p->stats.wait_sum_us.fetch_add(wait_us,std::memory_order_relaxed);
+    p->stats.wait_sum_sq_us.fetch_add(wait_us*wait_us,std::memory_order_relaxed);
+    p->stats.offs_sum.fetch_add(offs,std::memory_order_relaxed);
+    _update_max(p->stats.wait_max_us,wait_us);
+    _update_max(p->stats.offs_max,offs);
+    if( wait_us < p->stats.wait_min_us.load(std::memory_order_relaxed) )
+      p->stats.wait_min_us.store(wait_us,std::memory_order_relaxed);
+  }
+
+  p->tail.store(tail,std::memory_order_release);
+
+  p->stats.msg_cnt.fetch_add(msgN,std::memory_order_relaxed);
+  p->stats.stat_cnt.fetch_add(msgN,std::memory_order_relaxed);
+  _update_max(p->stats.max_depth,msgN);
+
+  msgA_ref = p->cycleA;
+  return msgN;
+}
+
+void caw::midi_queue::usage( handle_t h, usage_t& usageRef )
+{
+  usageRef = {};
+
+  if( !h.isValid() )
+    return;
+
+  midi_queue_t* p = _handleToPtr(h);
+  u64_t         n = p->stats.stat_cnt.load();
+
+  usageRef.capacity     = p->ringN;
+  usageRef.msg_cnt      = p->stats.msg_cnt.load();
+  usageRef.overflow_cnt = p->stats.overflow_cnt.load();
+  usageRef.late_cnt     = p->stats.late_cnt.load();
+  usageRef.max_depth    = p->stats.max_depth.load();
+  usageRef.wait_mean_us = n==0 ? 0 : (double)p->stats.wait_sum_us.load() / n;
+  usageRef.wait_max_us  = p->stats.wait_max_us.load();
+}
+
+void caw::midi_queue::report( handle_t h )
+{
+  if( !h.isValid() )
+    return;
+
+  midi_queue_t* p         = _handleToPtr(h);
+  u64_t         n         = p->stats.stat_cnt.load();
+  unsigned      srate     = p->clock_srate.load();
+  double        wait_mean = n==0 ? 0 : (double)p->stats.wait_sum_us.load() / n;
+  double        wait_var  = n==0 ? 0 : (double)p->stats.wait_sum_sq_us.load() / n - wait_mean*wait_mean;
+  double        offs_mean = n==0 ? 0 : (double)p->stats.offs_sum.load() / n;
+  double        fr_to_us  = srate==0 ? 0 : 1000000.0/srate;
+
+  cwLogInfo("MIDI in queue: msgs:%llu overflow:%llu late:%llu max/cycle:%llu queue:%i",
+            p->stats.msg_cnt.load(),p->stats.overflow_cnt.load(),p->stats.late_cnt.load(),p->stats.max_depth.load(),p->ringN);
+
+  // These measure the queue only. The collected msgs are not passed to the flow network.
+  cwLogInfo("MIDI in queue: arrival->cycle collection wait us: min:%llu mean:%.1f max:%llu std:%.1f (%llu msgs since reset)",
+            n==0 ? 0 : p->stats.wait_min_us.load(), wait_mean, p->stats.wait_max_us.load(), std::sqrt(std::max(wait_var,0.0)), n);
+
+  cwLogInfo("MIDI in queue: arrival offset into the cycle frames: mean:%.1f (%.1f us) max:%llu (%.1f us)",
+            offs_mean, offs_mean*fr_to_us, p->stats.offs_max.load(), p->stats.offs_max.load()*fr_to_us );
+}
+
+void caw::midi_queue::reset_stats( handle_t h )
+{
+  if( h.isValid() )
+    _handleToPtr(h)->reset_stats_fl.store(true);
+}
@@ -0,0 +1,70 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#ifndef cawMidiQueue_h
+#define cawMidiQueue_h
+
+// Lock-free (single producer/single consumer) MIDI ingress queue.
+//
+// The MIDI thread push()'es incoming messages and stamps each message with the
+// audio frame clock. The audio thread calls exec_cycle() once per network cycle
+// which advances the frame clock and returns the messages which arrived during
+// the previous cycle along with their frame offset into that cycle.
+// The collected messages are not passed to the flow network - the network's
+// MIDI input is read by libcw. They are used by the MIDI recorder (caw::midi_rec)
+// and by the queue statistics.
+
+namespace caw
+{
+  namespace midi_queue
+  {
+    typedef cw::handle<struct midi_queue_str> handle_t;
+
+    typedef struct msg_str
+    {
+      unsigned long long frame;      // Audio frame clock at arrival.
+      unsigned           frame_offs; // Frame offset into the cycle. (Set by exec_cycle()).
+      cw::time::spec_t   timestamp;  // Arrival time from the MIDI driver (or the time of push() if the driver did not stamp the msg).
+      unsigned           devIdx;
+      unsigned           portIdx;
+      uint8_t            ch;
+      uint8_t            status;
+      uint8_t            d0;
+      uint8_t            d1;
+    } msg_t;
+
+    // msgCnt is the max. count of messages which may be queued between two audio cycles.
+    cw::rc_t create( handle_t& hRef, unsigned msgCnt );
+    cw::rc_t destroy( handle_t& hRef );
+
+    // Called from the MIDI thread.
+    cw::rc_t push( handle_t h, const cw::midi::packet_t* pkt );
+
+    // Called from the audio thread at the start of each cycle.
+    // Returns the count of messages in msgA_ref[] which should be applied to this cycle.
+    // msgA_ref[] is valid until the next call to exec_cycle().
+    unsigned exec_cycle( handle_t h, double srate, unsigned frmN, const msg_t*& msgA_ref );
+
+    typedef struct usage_str
+    {
+      unsigned           capacity;     // queue size in messages
+      unsigned long long msg_cnt;      // messages collected by exec_cycle()
+      unsigned long long overflow_cnt; // messages dropped because the queue was full
+      unsigned long long late_cnt;     // messages whose offset was clamped to the end of the cycle
+      unsigned long long max_depth;    // max. count of messages collected in one cycle (since reset_stats())
+      double             wait_mean_us; // time from arrival to collection by exec_cycle() (since reset_stats())
+      unsigned long long wait_max_us;  //
+    } usage_t;
+
+    // Get the queue usage statistics.
+    void usage( handle_t h, usage_t& usageRef );
+
+    // Print the queue usage and timing statistics.
+    void report( handle_t h );
+
+    // Restart the max. depth, wait time and offset statistics.
+    // The message, overflow and late counts are totals and are not reset.
+    void reset_stats( handle_t h );
+  }
+}
+
+#endif
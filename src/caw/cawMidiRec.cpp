@@ -0,0 +1,313 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#include "cwCommon.h"
+#include "cwLog.h"
+#include "cwCommonImpl.h"
+#include "cwMem.h"
+#include "cwFileSys.h"
+#include "cwTime.h"
+#include "cwMidiDecls.h"
+
+#include "cawMidiQueue.h"
+#include "cawMidiRec.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace cw;
+
+namespace caw
+{
+  namespace midi_rec
+  {
+    typedef unsigned long long u64_t;
+
+    enum { kLineBufByteN = 64*1024 };
+
+    typedef struct midi_rec_str
+    {
+      args_t                  args;
+      char*                   fname;
+      int                     fd;
+      time::spec_t            t0;          // creation time - the 'sec' column is relative to this time
+
+      midi_queue::msg_t*      ringA;       // ringA[ringN] SPSC ring
+      unsigned                ringN;       // power of two
+      std::atomic<u64_t>      head;        // written by the producer (audio thread)
+      std::atomic<u64_t>      tail;        // written by the consumer (writer thread)
+      std::atomic<u64_t>      drop_cnt;    // messages dropped because the ring was full
+
+      std::thread             thread;
+      std::mutex              stopMutex;
+      std::condition_variable stopCond;
+      bool                    stop_fl;     // guarded by stopMutex
+
+      char*                   lineBuf;     // lineBuf[kLineBufByteN] formatted lines waiting to be written
+      unsigned                lineByteN;
+      time::spec_t            sync_time;   // time of the last fdatasync()
+      bool                    dirty_fl;    // records were written since the last fdatasync()
+
+      std::atomic<u64_t>      rec_cnt;     // messages written to the file
+      std::atomic<u64_t>      sync_cnt;
+      std::atomic<u64_t>      err_cnt;     // failed writes and syncs
+    } midi_rec_t;
+
+    midi_rec_t* _handleToPtr( handle_t h )
+    { return handleToPtr<handle_t,midi_rec_t>(h); }
+
+    rc_t _write_all( midi_rec_t* p, const char* buf, unsigned byteN )
+    {
+      while( byteN > 0 )
+      {
+        ssize_t n = ::write(p->fd,buf,byteN);
+
+        if( n < 0 )
+        {
+          if( errno == EINTR )
+            continue;
+
+          p->err_cnt.fetch_add(1,std::memory_order_relaxed);
+          return cwLogError(kWriteFailRC,"MIDI recording write failed on '%s'. (%s)",p->fname,strerror(errno));
+        }
+
+        buf   += n;
+        byteN -= (unsigned)n;
+      }
+
+      return kOkRC;
+    }
+
+    rc_t _flush_lines( midi_rec_t* p )
+    {
+      rc_t rc = _write_all(p,p->lineBuf,p->lineByteN);
+      p->lineByteN = 0;
+      return rc;
+    }
+
+    void _sync( midi_rec_t* p )
+    {
+      if( fdatasync(p->fd) != 0 )
+      {
+        p->err_cnt.fetch_add(1,std::memory_order_relaxed);
+        cwLogError(kFlushFailRC,"MIDI recording sync failed on '%s'. (%s)",p->fname,strerror(errno));
+      }
+
+      p->sync_cnt.fetch_add(1,std::memory_order_relaxed);
+      p->dirty_fl = false;
+      time::get(p->sync_time);
+    }
+
+    // Write the queued messages to the file and sync the file if the sync period has elapsed. (Writer thread)
+    void _drain( midi_rec_t* p, bool sync_fl )
+    {
+      u64_t tail = p->tail.load(std::memory_order_relaxed);
+      u64_t head = p->head.load(std::memory_order_acquire);
+      u64_t n    = head - tail;
+
+      for(; tail != head; ++tail)
+      {
+        const midi_queue::msg_t* m = p->ringA + (tail & (p->ringN-1));
+
+        // keep room for one line at the end of the buffer
+        if( p->lineByteN + 128 > kLineBufByteN )
+          _flush_lines(p);
+
+        double sec = time::elapsedMicros(p->t0,m->timestamp) / 1000000.0;
+
+        p->lineByteN += snprintf(p->lineBuf + p->lineByteN, kLineBufByteN - p->lineByteN,
+                                 "%llu,%u,%.6f,%u,%u,%u,0x%02x,%u,%u\n",
+                                 m->frame, m->frame_offs, sec, m->devIdx, m->portIdx, m->ch, m->status, m->d0, m->d1 );
+
+        p->tail.store(tail+1,std::memory_order_release);
+      }
+
+      if( p->lineByteN )
+        _flush_lines(p);
+
+      if( n > 0 )
+      {
+        p->rec_cnt.fetch_add(n,std::memory_order_relaxed);
+        p->dirty_fl = true;
+      }
+
+      if( p->dirty_fl && (sync_fl || time::elapsedMicros(p->sync_time) >= p->args.fsync_period_ms * 1000ull) )
+        _sync(p);
+    }
+
+    void _thread_func( midi_rec_t* p )
+    {
+      std::unique_lock<std::mutex> lock(p->stopMutex);
+
+      while( !p->stop_fl )
+      {
+        p->stopCond.wait_for(lock,std::chrono::milliseconds(p->args.write_period_ms),[p]{ return p->stop_fl; });
+
+        lock.unlock();
+        _drain(p,false);
+        lock.lock();
+      }
+
+      // write anything which arrived before the stop and sync the file
+      _drain(p,true);
+    }
+
+    rc_t _destroy( midi_rec_t* p )
+    {
+      if( p->thread.joinable() )
+      {
+        {
+          std::lock_guard<std::mutex> lock(p->stopMutex);
+          p->stop_fl = true;
+        }
+
+        p->stopCond.notify_one();
+        p->thread.join();
+      }
+
+      if( p->fd != -1 )
+        ::close(p->fd);
+
+      mem::release(p->fname);
+      mem::release(p->ringA);
+      mem::release(p->lineBuf);
+      delete p;
+
+      return kOkRC;
+    }
+  }
+}
+
+void caw::midi_rec::default_args( args_t& args )
+{
+  args.ringMsgCnt      = 4096;
+  args.write_period_ms = 100;
+  args.fsync_period_ms = 1000;
+}
+
+cw::rc_t caw::midi_rec::create( handle_t& hRef, const char* dir, const char* fname, const args_t& args )
+{
+  rc_t        rc      = kOkRC;
+  midi_rec_t* p       = nullptr;
+  char*       exp_dir = nullptr;
+  char        label[ 256 ];
+  char        date[ 32 ];
+  time_t      now     = std::time(nullptr);
+  const char* header  = "frame,frame_offs,sec,dev,port,ch,status,d0,d1\n";
+
+  if((rc = destroy(hRef)) != kOkRC )
+    return rc;
+
+  strftime(date,sizeof(date),"%Y%m%d_%H%M%S",localtime(&now));
+  snprintf(label,sizeof(label),"%s_%s",fname==nullptr ? "midi" : fname,date);
+
+  p         = new midi_rec_t();
+  p->args   = args;
+  p->fd     = -1;
+  exp_dir   = filesys::expandPath(dir==nullptr ? "." : dir);
+  p->fname  = filesys::makeFn(exp_dir,label,"csv",nullptr);
+
+  p->ringN = 16;
+  while( p->ringN < args.ringMsgCnt )
+    p->ringN <<= 1;
+
+  p->ringA   = mem::allocZ<midi_queue::msg_t>(p->ringN);
+  p->lineBuf = mem::allocZ<char>(kLineBufByteN);
+
+  if((p->fd = ::open(p->fname,O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1 )
+  {
+    rc = cwLogError(kOpenFailRC,"The MIDI recording file '%s' could not be created. (%s)",cwStringNullGuard(p->fname),strerror(errno));
+    goto errLabel;
+  }
+
+  if((rc = _write_all(p,header,(unsigned)strlen(header))) != kOkRC )
+    goto errLabel;
+
+  time::get(p->t0);
+  p->sync_time = p->t0;
+
+  p->thread = std::thread(_thread_func,p);
+
+  cwLogInfo("Recording MIDI input to '%s'.",p->fname);
+
+  hRef.set(p);
+
+errLabel:
+  mem::release(exp_dir);
+
+  if( rc != kOkRC )
+  {
+    _destroy(p);
+    rc = cwLogError(rc,"MIDI recorder create failed.");
+  }
+
+  return rc;
+}
+
+cw::rc_t caw::midi_rec::destroy( handle_t& hRef )
+{
+  rc_t rc = kOkRC;
+
+  if( !hRef.isValid() )
+    return rc;
+
+  midi_rec_t* p = _handleToPtr(hRef);
+
+  if((rc = _destroy(p)) != kOkRC )
+  {
+    rc = cwLogError(rc,"MIDI recorder destroy failed.");
+    goto errLabel;
+  }
+
+  hRef.clear();
+
+errLabel:
+  return rc;
+}
+
+void caw::midi_rec::write( handle_t h, const midi_queue::msg_t* msgA, unsigned msgN )
+{
+  if( !h.isValid() || msgN == 0 )
+    return;
+
+  midi_rec_t* p    = _handleToPtr(h);
+  u64_t       head = p->head.load(std::memory_order_relaxed);
+  u64_t       tail = p->tail.load(std::memory_order_acquire);
+
+  for(unsigned i=0; i<msgN; ++i)
+  {
+    if( head - tail >= p->ringN )
+    {
+      p->drop_cnt.fetch_add(msgN-i,std::memory_order_relaxed);
+      break;
+    }
+
+    p->ringA[ head & (p->ringN-1) ] = msgA[i];
+    ++head;
+  }
+
+  p->head.store(head,std::memory_order_release);
+}
+
+void caw::midi_rec::report( handle_t h )
+{
+  if( !h.isValid() )
+    return;
+
+  midi_rec_t* p = _handleToPtr(h);
+
+  cwLogPrint("midi_rec: file:%s records:%llu dropped:%llu syncs:%llu errors:%llu\n",
+             p->fname,
+             p->rec_cnt.load(),
+             p->drop_cnt.load(),
+             p->sync_cnt.load(),
+             p->err_cnt.load());
+}
@@ -0,0 +1,46 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#ifndef cawMidiRec_h
+#define cawMidiRec_h
+
+// Streaming MIDI input recorder.
+//
+// The audio thread passes each cycle's MIDI input to write() which copies the
+// messages into a lock-free (single producer/single consumer) ring and never blocks.
+// A background thread drains the ring every 'write_period_ms' and appends the
+// messages, as CSV lines, to '<dir>/<fname>_<date>_<time>.csv'. The file is only
+// ever appended to and is fdatasync()'ed every 'fsync_period_ms' so a crash loses
+// at most the last period and, at worst, leaves a partial last line.
+//
+// The recording length is not bounded by the ring size - the ring only needs to
+// hold the messages which arrive during one write period.
+
+namespace caw
+{
+  namespace midi_rec
+  {
+    typedef cw::handle<struct midi_rec_str> handle_t;
+
+    typedef struct args_str
+    {
+      unsigned ringMsgCnt;       // ring size in messages
+      unsigned write_period_ms;  // ring drain period
+      unsigned fsync_period_ms;  // file sync period
+    } args_t;
+
+    void default_args( args_t& args );
+
+    cw::rc_t create( handle_t& hRef, const char* dir, const char* fname, const args_t& args );
+
+    // Stop the writer thread after it has written all the queued messages and close the file.
+    cw::rc_t destroy( handle_t& hRef );
+
+    // Called from the audio thread with the messages collected by the current cycle.
+    void write( handle_t h, const midi_queue::msg_t* msgA, unsigned msgN );
+
+    // Print the file name and the record, drop and sync counts.
+    void report( handle_t h );
+  }
+}
+
+#endif
@@ -0,0 +1,27 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#include <cstring>
+
+#include "cawMix.h"
+
+void caw::mix::zero( sample_t** chA, unsigned chN, unsigned frmN )
+{
+  for(unsigned ch=0; ch<chN; )
+  {
+    unsigned runN = 1;
+
+    if( chA[ch] == nullptr )
+    {
+      ++ch;
+      continue;
+    }
+
+    // extend the run while the next channel immediately follows this one
+    while( ch+runN < chN && chA[ch+runN] == chA[ch] + runN*frmN )
+      ++runN;
+
+    memset(chA[ch],0,runN*frmN*sizeof(sample_t));
+
+    ch += runN;
+  }
+}
@@ -0,0 +1,23 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#ifndef cawMix_h
+#define cawMix_h
+
+// Output stage helpers for the device channel buffers.
+// All buffers are planar (one buffer per channel).
+
+namespace caw
+{
+  namespace mix
+  {
+    typedef float sample_t;
+
+    // Zero chN planar channel buffers.
+    // Runs of channels which are contiguous in memory (chA[ch+1] == chA[ch] + frmN)
+    // are cleared with a single memset() - for the usual device buffer layout this
+    // clears all channels in one pass.
+    void zero( sample_t** chA, unsigned chN, unsigned frmN );
+  }
+}
+
+#endif
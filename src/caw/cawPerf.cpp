@@ -0,0 +1,108 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#include "cawPerf.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace caw {
+
+  namespace perf {
+
+    // Nearest rank percentile of the sorted array xA[xN].
+    double _percentile( const double* xA, unsigned xN, double pct )
+    {
+      unsigned i = (unsigned)std::ceil( pct * xN / 100.0 - 1e-9 );
+      return xA[ i==0 ? 0 : std::min(i,xN)-1 ];
+    }
+  }
+}
+
+void caw::perf::calc_stats( double* xA, unsigned xN, stats_t& s )
+{
+  s = {};
+
+  if( xN == 0 )
+    return;
+
+  std::sort(xA,xA+xN);
+
+  double sum = 0;
+  double sum_sq = 0;
+  for(unsigned i=0; i<xN; ++i)
+  {
+    sum    += xA[i];
+    sum_sq += xA[i]*xA[i];
+  }
+
+  s.n    = xN;
+  s.min  = xA[0];
+  s.max  = xA[xN-1];
+  s.mean = sum / xN;
+  s.std  = std::sqrt( std::max( sum_sq/xN - s.mean*s.mean, 0.0 ) );
+  s.p50  = _percentile(xA,xN,50.0);
+  s.p90  = _percentile(xA,xN,90.0);
+  s.p99  = _percentile(xA,xN,99.0);
+  s.p999 = _percentile(xA,xN,99.9);
+}
+
+unsigned caw::perf::peak_rss_kb()
+{
+  unsigned      kb = 0;
+  char          line[128];
+  FILE*         fp = fopen("/proc/self/status","r");
+  struct rusage ru = {};
+
+  // VmHWM follows reset_peak_rss() - ru_maxrss is never reset
+  if( fp != nullptr )
+  {
+    while( fgets(line,sizeof(line),fp) != nullptr )
+      if( strncmp(line,"VmHWM:",6) == 0 )
+      {
+        sscanf(line+6,"%u",&kb);
+        break;
+      }
+
+    fclose(fp);
+  }
+
+  if( kb == 0 && getrusage(RUSAGE_SELF,&ru) == 0 )
+    kb = (unsigned)ru.ru_maxrss; // linux reports kilobytes
+
+  return kb;
+}
+
+bool caw::perf::reset_peak_rss()
+{
+  FILE* fp = fopen("/proc/self/clear_refs","w");
+  bool  fl = false;
+
+  if( fp != nullptr )
+  {
+    fl = fputs("5",fp) >= 0;
+    fl = fclose(fp) == 0 && fl;
+  }
+
+  return fl;
+}
+
+unsigned caw::perf::current_rss_kb()
+{
+  unsigned long size_pages = 0;
+  unsigned long rss_pages  = 0;
+  FILE*         fp         = fopen("/proc/self/statm","r");
+
+  if( fp == nullptr )
+    return 0;
+
+  if( fscanf(fp,"%lu %lu",&size_pages,&rss_pages) != 2 )
+    rss_pages = 0;
+
+  fclose(fp);
+
+  return (unsigned)(rss_pages * (unsigned long)sysconf(_SC_PAGESIZE) / 1024);
+}
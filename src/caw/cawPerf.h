@@ -0,0 +1,40 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#ifndef cawPerf_h
+#define cawPerf_h
+
+// Timing statistics and process memory helpers used by caw_bench.
+
+namespace caw
+{
+  namespace perf
+  {
+    typedef struct stats_str
+    {
+      unsigned n;      // count of samples
+      double   min;
+      double   max;
+      double   mean;
+      double   std;
+      double   p50;    // percentiles
+      double   p90;
+      double   p99;
+      double   p999;
+    } stats_t;
+
+    // Calculate the statistics of xA[xN]. xA[] is sorted in place.
+    void calc_stats( double* xA, unsigned xN, stats_t& stats_ref );
+
+    // Peak resident set size of this process in kilobytes (VmHWM).
+    unsigned peak_rss_kb();
+
+    // Reset the peak resident set size to the current resident set size.
+    // Returns false if the kernel does not support the reset (linux < 4.0).
+    bool reset_peak_rss();
+
+    // Current resident set size of this process in kilobytes.
+    unsigned current_rss_kb();
+  }
+}
+
+#endif
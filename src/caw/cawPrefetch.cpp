@@ -0,0 +1,407 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#include "cwCommon.h"
+#include "cwLog.h"
+#include "cwCommonImpl.h"
+#include "cwMem.h"
+#include "cwText.h"
+#include "cwObject.h"
+#include "cwFileSys.h"
+#include "cwTime.h"
+
+#include "cawPrefetch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cw;
+
+namespace caw
+{
+  namespace prefetch
+  {
+    typedef unsigned long long u64_t;
+
+    enum { kReadBufByteN = 256*1024 };
+
+    typedef struct file_str
+    {
+      char*    fname;
+      u64_t    byteN;
+      bool     done_fl;   // already read while scanning for nested file names
+    } file_t;
+
+    typedef struct prefetch_str
+    {
+      args_t                args;
+      const object_t*       flow_cfg;
+      char*                 base_dir;
+      char*                 pgm_label;
+      time::spec_t          t0;
+
+      file_t*               fileA;      // fileA[ fileAllocN ]
+      unsigned              fileN;
+      unsigned              fileAllocN;
+      u64_t                 totalByteN;
+      u64_t                 maxByteN;   // read budget (0 = no limit)
+      unsigned              skipN;      // count of files which did not fit in the budget
+      u64_t                 skipByteN;
+      unsigned              threadN;    // count of reader threads
+
+      std::thread           thread;     // collects the file names and runs the reader threads
+      std::atomic<bool>     stop_fl;    // set by stop()
+      std::atomic<unsigned> nextIdx;    // next file to be read by a reader thread
+      std::atomic<unsigned> doneN;
+      std::atomic<u64_t>    doneByteN;
+      std::atomic<unsigned> errN;
+    } prefetch_t;
+
+    prefetch_t* _handleToPtr( handle_t h )
+    { return handleToPtr<handle_t,prefetch_t>(h); }
+
+    bool _has_ext( const char* fname, const char* ext )
+    {
+      unsigned n = textLength(fname);
+      unsigned m = textLength(ext);
+      return n > m && strcmp(fname + n - m, ext) == 0;
+    }
+
+    // Add 'fname' to the file list if it names a regular file which is not already in the list.
+    void _add_file( prefetch_t* p, const char* fname )
+    {
+      struct stat st;
+
+      if( fname == nullptr || stat(fname,&st) != 0 || !S_ISREG(st.st_mode) )
+        return;
+
+      for(unsigned i=0; i<p->fileN; ++i)
+        if( textIsEqual(p->fileA[i].fname,fname) )
+          return;
+
+      if( p->maxByteN != 0 && p->totalByteN + (u64_t)st.st_size > p->maxByteN )
+      {
+        p->skipN     += 1;
+        p->skipByteN += (u64_t)st.st_size;
+        return;
+      }
+
+      if( p->fileN == p->fileAllocN )
+      {
+        p->fileAllocN = p->fileAllocN==0 ? 64 : p->fileAllocN*2;
+        p->fileA      = mem::resizeZ<file_t>(p->fileA,p->fileAllocN);
+      }
+
+      p->fileA[ p->fileN ].fname   = mem::duplStr(fname);
+      p->fileA[ p->fileN ].byteN   = (u64_t)st.st_size;
+      p->fileA[ p->fileN ].done_fl = false;
+      p->fileN      += 1;
+      p->totalByteN += (u64_t)st.st_size;
+    }
+
+    // Resolve a file name argument and add it to the file list.
+    void _add_arg( prefetch_t* p, const char* arg )
+    {
+      char  buf[ PATH_MAX ];
+      char* fname = nullptr;
+
+      if( arg == nullptr || arg[0] == 0 )
+        return;
+
+      if( arg[0] == '$' && arg[1] == '/' )
+      {
+        if( p->base_dir == nullptr )
+          return;
+
+        // try the program directory and then the base directory
+        snprintf(buf,sizeof(buf),"%s/%s/%s",p->base_dir,cwStringNullGuard(p->pgm_label),arg+2);
+        if( access(buf,R_OK) != 0 )
+          snprintf(buf,sizeof(buf),"%s/%s",p->base_dir,arg+2);
+
+        _add_file(p,buf);
+        return;
+      }
+
+      if((fname = filesys::expandPath(arg)) != nullptr )
+      {
+        _add_file(p,fname);
+        mem::release(fname);
+      }
+    }
+
+    // Add the string values of all pairs whose label contains 'fname'.
+    void _walk( prefetch_t* p, const object_t* o )
+    {
+      if( o == nullptr )
+        return;
+
+      if( o->is_pair() )
+      {
+        const char*     label = o->pair_label();
+        const object_t* value = o->pair_value();
+        const char*     s     = nullptr;
+
+        if( label != nullptr && strstr(label,"fname") != nullptr && value != nullptr && value->is_string() && value->value(s) == kOkRC )
+          _add_arg(p,s);
+
+        _walk(p,value);
+        return;
+      }
+
+      for(unsigned i=0; i<o->child_count(); ++i)
+        _walk(p,o->child_ele(i));
+    }
+
+    // Add the quoted absolute paths found in 'text' to the file list.
+    void _scan( prefetch_t* p, const char* text, unsigned textByteN )
+    {
+      char        buf[ PATH_MAX ];
+      const char* end = text + textByteN;
+
+      for(const char* s = text; s < end; ++s)
+      {
+        if( *s != '"' || s+1 >= end || (s[1] != '/' && s[1] != '~') )
+          continue;
+
+        const char* q = (const char*)memchr(s+1,'"',end-(s+1));
+
+        if( q == nullptr )
+          break;
+
+        unsigned n = (unsigned)(q - (s+1));
+
+        if( n < sizeof(buf) )
+        {
+          memcpy(buf,s+1,n);
+          buf[n] = 0;
+          _add_arg(p,buf);
+        }
+
+        s = q;
+      }
+    }
+
+    // Read a file into the page cache. The contents are discarded.
+    rc_t _read_file( prefetch_t* p, file_t* f, char* buf )
+    {
+      int   fd;
+      u64_t byteN = 0;
+
+      if((fd = ::open(f->fname,O_RDONLY | O_CLOEXEC)) == -1 )
+      {
+        p->errN.fetch_add(1);
+        return kOpenFailRC;
+      }
+
+      posix_fadvise(fd,0,0,POSIX_FADV_SEQUENTIAL);
+
+      ssize_t n;
+      while((n = ::read(fd,buf,kReadBufByteN)) > 0 && !p->stop_fl.load(std::memory_order_relaxed) )
+      {
+        byteN += (u64_t)n;
+        p->doneByteN.fetch_add((u64_t)n,std::memory_order_relaxed);
+      }
+
+      if( n < 0 )
+        p->errN.fetch_add(1);
+
+      ::close(fd);
+
+      return n < 0 ? kReadFailRC : kOkRC;
+    }
+
+    // Read a .cfg/.json file and add the absolute paths which it contains to the file list.
+    void _scan_file( prefetch_t* p, file_t* f )
+    {
+      FILE*    fp    = nullptr;
+      char*    text  = nullptr;
+      unsigned n     = (unsigned)f->byteN;
+
+      if((fp = fopen(f->fname,"rb")) == nullptr )
+        return;
+
+      text = mem::allocZ<char>(n+1);
+      n    = (unsigned)fread(text,1,n,fp);
+      fclose(fp);
+
+      f->done_fl = true;
+      p->doneN.fetch_add(1);
+      p->doneByteN.fetch_add(n);
+
+      _scan(p,text,n);
+
+      mem::release(text);
+    }
+
+    void _thread_func( prefetch_t* p )
+    {
+      char*    buf = mem::allocZ<char>(kReadBufByteN);
+      unsigned i;
+
+      while(!p->stop_fl.load(std::memory_order_relaxed) && (i = p->nextIdx.fetch_add(1)) < p->fileN )
+        if( !p->fileA[i].done_fl )
+        {
+          _read_file(p,p->fileA + i,buf);
+          p->doneN.fetch_add(1);
+        }
+
+      mem::release(buf);
+    }
+
+    void _log_progress( prefetch_t* p )
+    {
+      cwLogInfo("Prefetch: %i of %i files, %.1f of %.1f MB.",
+                p->doneN.load(), p->fileN, p->doneByteN.load()/1048576.0, p->totalByteN/1048576.0 );
+    }
+
+    void _main_func( prefetch_t* p )
+    {
+      const object_t* pgmL     = nullptr;
+      const object_t* pgm_cfg  = nullptr;
+      std::thread*    threadA  = nullptr;
+      unsigned        argFileN = 0;
+      unsigned        waitMs   = 0;
+
+      if((pgmL = p->flow_cfg->find_child("programs")) == nullptr || (pgm_cfg = pgmL->find_child(p->pgm_label)) == nullptr )
+      {
+        cwLogWarning("Prefetch: the program '%s' was not found.",p->pgm_label);
+        return;
+      }
+
+      _walk(p,pgm_cfg);
+
+      // the cfg. files named by the program args may name further files
+      argFileN = p->fileN;
+      for(unsigned i=0; i<argFileN && !p->stop_fl.load(); ++i)
+        if( _has_ext(p->fileA[i].fname,".cfg") || _has_ext(p->fileA[i].fname,".json") )
+          _scan_file(p,p->fileA + i);
+
+      if( p->fileN == 0 || p->stop_fl.load() )
+        return;
+
+      p->threadN = std::max(1u,std::min(p->args.threadN,p->fileN));
+      threadA    = new std::thread[ p->threadN ];
+
+      for(unsigned i=0; i<p->threadN; ++i)
+        threadA[i] = std::thread(_thread_func,p);
+
+      while( p->doneN.load() < p->fileN && !p->stop_fl.load() )
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        if((waitMs += 10) >= std::max(10u,p->args.log_period_ms) )
+        {
+          _log_progress(p);
+          waitMs = 0;
+        }
+      }
+
+      for(unsigned i=0; i<p->threadN; ++i)
+        threadA[i].join();
+
+      delete[] threadA;
+    }
+
+    rc_t _destroy( prefetch_t* p )
+    {
+      if( p == nullptr )
+        return kOkRC;
+
+      if( p->thread.joinable() )
+      {
+        p->stop_fl.store(true);
+        p->thread.join();
+      }
+
+      for(unsigned i=0; i<p->fileN; ++i)
+        mem::release(p->fileA[i].fname);
+
+      mem::release(p->fileA);
+      mem::release(p->base_dir);
+      mem::release(p->pgm_label);
+      delete p;
+
+      return kOkRC;
+    }
+  }
+}
+
+void caw::prefetch::default_args( args_t& args )
+{
+  args.threadN       = std::max(1u,std::min(8u,std::thread::hardware_concurrency()));
+  args.max_mb        = 1024;
+  args.log_period_ms = 500;
+}
+
+cw::rc_t caw::prefetch::start( handle_t& hRef, const object_t* flow_cfg, const char* pgm_label, const args_t& args )
+{
+  rc_t        rc       = kOkRC;
+  prefetch_t* p        = nullptr;
+  const char* base_dir = nullptr;
+
+  if((rc = stop(hRef)) != kOkRC )
+    return rc;
+
+  if( flow_cfg == nullptr || pgm_label == nullptr )
+    return rc;
+
+  flow_cfg->getv_opt("base_dir",base_dir);
+
+  p            = new prefetch_t();
+  p->args      = args;
+  p->flow_cfg  = flow_cfg;
+  p->base_dir  = base_dir==nullptr ? nullptr : filesys::expandPath(base_dir);
+  p->pgm_label = mem::duplStr(pgm_label);
+  p->maxByteN  = (u64_t)args.max_mb * 1048576ull;
+
+  time::get(p->t0);
+
+  p->thread = std::thread(_main_func,p);
+
+  hRef.set(p);
+
+  return rc;
+}
+
+cw::rc_t caw::prefetch::stop( handle_t& hRef )
+{
+  rc_t rc = kOkRC;
+
+  if( !hRef.isValid() )
+    return rc;
+
+  prefetch_t* p = _handleToPtr(hRef);
+
+  // cancel the remaining reads - the program has been initialized
+  p->stop_fl.store(true);
+  p->thread.join();
+
+  if( p->fileN > 0 )
+    cwLogInfo("Prefetch: %i of %i files, %.1f MB in %.2f seconds on %i threads.",
+              p->doneN.load(), p->fileN, p->doneByteN.load()/1048576.0, time::elapsedMicros(p->t0)/1000000.0, p->threadN );
+
+  if( p->skipN > 0 )
+    cwLogInfo("Prefetch: %i files (%.1f MB) were not read because they exceed the %i MB budget.",
+              p->skipN, p->skipByteN/1048576.0, p->args.max_mb );
+
+  if( p->errN.load() > 0 )
+    cwLogWarning("Prefetch: %i files could not be read.",p->errN.load());
+
+  if((rc = _destroy(p)) != kOkRC )
+  {
+    rc = cwLogError(rc,"Prefetch destroy failed.");
+    goto errLabel;
+  }
+
+  hRef.clear();
+
+errLabel:
+  return rc;
+}
@@ -0,0 +1,49 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#ifndef cawPrefetch_h
+#define cawPrefetch_h
+
+// Parallel read-ahead of the files referenced by a program.
+//
+// Program initialization opens the files named by the processor arguments (scores,
+// wavetable banks, velocity tables, control cfg's ...) one processor at a time.
+// start() collects every string argument whose label contains 'fname' from the
+// program's cfg, reads the .cfg/.json files among them for further absolute paths
+// (e.g. the audio files of a wavetable bank) and then reads the files into the
+// page cache on 'threadN' threads. All of this happens on background threads while
+// the program is initialized. The files are read in the order in which the program
+// names them, which is the order in which initialization opens them, so the reads
+// stay ahead of the initialization.
+//
+// At most 'max_mb' megabytes are read. Files which would exceed the budget are skipped.
+// stop() cancels the reads which have not completed. It is called when the
+// initialization is complete.
+//
+// A leading '$/' is resolved against '<base_dir>/<pgm_label>/' and then '<base_dir>/'.
+// Progress is logged every 'log_period_ms'.
+
+namespace caw
+{
+  namespace prefetch
+  {
+    typedef cw::handle<struct prefetch_str> handle_t;
+
+    typedef struct args_str
+    {
+      unsigned threadN;        // count of reader threads
+      unsigned max_mb;         // read budget in megabytes (0 = no limit)
+      unsigned log_period_ms;  // progress log period
+    } args_t;
+
+    void default_args( args_t& args );
+
+    // Start reading the files referenced by the program 'pgm_label' of 'flow_cfg' into the page cache.
+    // 'flow_cfg' must remain valid until stop() is called.
+    cw::rc_t start( handle_t& hRef, const cw::object_t* flow_cfg, const char* pgm_label, const args_t& args );
+
+    // Cancel the remaining reads, wait for the reader threads and release the handle.
+    cw::rc_t stop( handle_t& hRef );
+  }
+}
+
+#endif
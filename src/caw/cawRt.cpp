@@ -0,0 +1,501 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#include "cwCommon.h"
+#include "cwLog.h"
+#include "cwCommonImpl.h"
+#include "cwMem.h"
+#include "cwObject.h"
+#include "cwTime.h"
+
+#include "cawRt.h"
+
+#include <alloca.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+using namespace cw;
+
+namespace caw
+{
+  namespace rt
+  {
+    enum {
+      kNotAppliedStateId,
+      kAppliedStateId,    // applied but not yet logged
+      kReportedStateId
+    };
+
+    typedef unsigned long long u64_t;
+
+    // Floating point control and status bits. On x86 the control and status bits share MXCSR.
+#if defined(__SSE__)
+    enum {
+      kFtzDazMask    = 0x8040,   // MXCSR FTZ (bit 15) | DAZ (bit 6)
+      kDenormFlag    = 0x0002,   // MXCSR DE: a denormal operand was used
+      kUnderflowFlag = 0x0010    // MXCSR UE: a result was denormal (or was flushed to zero)
+    };
+
+    const char* const kDenormLabel = "denormal operands";
+
+    unsigned _fp_ctl_get()                { return _mm_getcsr(); }
+    void     _fp_ctl_set( unsigned v )    { _mm_setcsr(v); }
+    unsigned _fp_status_get()             { return _mm_getcsr(); }
+    void     _fp_status_set( unsigned v ) { _mm_setcsr(v); }
+#elif defined(__aarch64__)
+    enum {
+      kFtzDazMask    = 1u << 24, // FPCR FZ: flush denormal operands and results to zero
+      kUnderflowFlag = 1u << 3,       // FPSR UFC: a result was denormal (or was flushed to zero)
+      kDenormFlag    = kUnderflowFlag // FPSR IDC is only set when FZ flushes an operand, so it is always clear
+                                      // while diagnosing. The cycles which produce denormals are counted instead.
+    };
+
+    const char* const kDenormLabel = "denormal results";
+
+    unsigned _fp_ctl_get()                { unsigned long v; __asm__ volatile("mrs %0, fpcr" : "=r"(v)); return (unsigned)v; }
+    void     _fp_ctl_set( unsigned v )    { unsigned long x = v; __asm__ volatile("msr fpcr, %0" : : "r"(x)); }
+    unsigned _fp_status_get()             { unsigned long v; __asm__ volatile("mrs %0, fpsr" : "=r"(v)); return (unsigned)v; }
+    void     _fp_status_set( unsigned v ) { unsigned long x = v; __asm__ volatile("msr fpsr, %0" : : "r"(x)); }
+#else
+    enum { kFtzDazMask=0, kDenormFlag=0, kUnderflowFlag=0 };
+
+    const char* const kDenormLabel = "";
+
+    unsigned _fp_ctl_get()                { return 0; }
+    void     _fp_ctl_set( unsigned )      {}
+    unsigned _fp_status_get()             { return 0; }
+    void     _fp_status_set( unsigned )   {}
+#endif
+
+    typedef struct thread_str
+    {
+      const char*           label;
+      int                   priority;       // SCHED_FIFO priority - 0 leaves the scheduling class unchanged
+      cpu_set_t             cpuSet;
+      unsigned              cpuN;           // count of cpus in cpuSet - 0 leaves the affinity unchanged
+
+      std::atomic<unsigned> state;
+      std::atomic<unsigned> applyCnt;       // count of threads which applied these settings
+      std::atomic<int>      tid;            // last thread to apply the settings
+      std::atomic<int>      sched_errno;    // 0 on success
+      std::atomic<int>      affinity_errno; //
+      std::atomic<bool>     ftz_daz_fl;     // FTZ/DAZ was set on the thread
+    } thread_t;
+
+    // Denormal diagnostic counts. Written by the audio thread.
+    typedef struct denorm_str
+    {
+      std::atomic<unsigned> cycleN;          // count of diagnosed cycles
+      std::atomic<unsigned> denormCycleN;    // count of cycles which used a denormal operand (aarch64: produced a denormal result)
+      std::atomic<unsigned> underflowCycleN; // count of cycles which produced a denormal result
+      std::atomic<u64_t>    denormSumUs;     // total exec time of the denormal cycles
+      std::atomic<u64_t>    cleanSumUs;      // total exec time of the other cycles
+      std::atomic<unsigned> denormMaxUs;
+      std::atomic<unsigned> cleanMaxUs;
+    } denorm_t;
+
+    typedef struct rt_str
+    {
+      bool     mlockall_fl;
+      bool     mlock_future_fl;
+      unsigned prefault_stack_kb;
+      bool     ftz_daz_fl;          // set FTZ/DAZ on the threads which execute the flow graph
+      bool     denorm_diag_fl;      // count the cycles which use or produce denormals
+
+      thread_t threadA[ kThreadCnt ];
+
+      // scheduling class and affinity of the process before any settings were applied
+      int                default_policy;
+      struct sched_param default_param;
+      cpu_set_t          default_cpuSet;
+      bool               default_fl;      // the defaults were read
+
+      bool     locked_fl;
+
+      denorm_t     denorm;
+      time::spec_t cycle_t0;        // start of the current diagnosed cycle (audio thread)
+      unsigned     denorm_logN;     // denormCycleN when last logged by exec()
+      time::spec_t denorm_log_t;    // time of the last denormal log line
+    } rt_t;
+
+    // Bit 'threadId' is set once the calling thread has applied the settings for 'threadId'.
+    thread_local unsigned t_appliedMask = 0;
+
+    rt_t* _handleToPtr( handle_t h )
+    { return handleToPtr<handle_t,rt_t>(h); }
+
+    const char* _errno_hint( int err )
+    { return err == EPERM ? " (check CAP_SYS_NICE or the 'rtprio' limit in /etc/security/limits.conf)" : ""; }
+
+    rc_t _parse_thread( rt_t* p, unsigned threadId, const object_t* rt_cfg, const char* label )
+    {
+      rc_t            rc   = kOkRC;
+      thread_t*       t    = p->threadA + threadId;
+      const object_t* cfg  = nullptr;
+      const object_t* cpuL = nullptr;
+
+      t->label = label;
+      CPU_ZERO(&t->cpuSet);
+
+      if((cfg = rt_cfg->find_child(label)) == nullptr )
+        goto errLabel;
+
+      if((rc = cfg->readv("priority", kOptFl, t->priority,
+                          "cpuL",     kOptFl, cpuL)) != kOkRC )
+      {
+        rc = cwLogError(rc,"The 'rt.%s' cfg. record parse failed.",label);
+        goto errLabel;
+      }
+
+      if( t->priority < 0 || t->priority > sched_get_priority_max(SCHED_FIFO) )
+      {
+        rc = cwLogError(kInvalidArgRC,"The 'rt.%s' priority %i is out of range (0 - %i).",label,t->priority,sched_get_priority_max(SCHED_FIFO));
+        goto errLabel;
+      }
+
+      for(unsigned i=0; cpuL != nullptr && i<cpuL->child_count(); ++i)
+      {
+        unsigned cpu = 0;
+        if((rc = cpuL->child_ele(i)->value(cpu)) != kOkRC || cpu >= CPU_SETSIZE )
+        {
+          rc = cwLogError(kInvalidArgRC,"The 'rt.%s' cpuL element %i is not a valid cpu index.",label,i);
+          goto errLabel;
+        }
+
+        CPU_SET(cpu,&t->cpuSet);
+        t->cpuN += 1;
+      }
+
+    errLabel:
+      return rc;
+    }
+
+    void _update_max( std::atomic<unsigned>& maxRef, unsigned v )
+    {
+      if( v > maxRef.load(std::memory_order_relaxed) )
+        maxRef.store(v,std::memory_order_relaxed);
+    }
+
+    // Touch 'byteN' of the stack below the caller so the pages are mapped before they are needed.
+    void __attribute__((noinline)) _prefault_stack( unsigned byteN )
+    {
+      volatile char* s = (volatile char*)alloca(byteN);
+      for(unsigned i=0; i<byteN; i+=4096)
+        s[i] = 0;
+    }
+  }
+}
+
+cw::rc_t caw::rt::create( handle_t& hRef, const object_t* rt_cfg )
+{
+  rc_t  rc;
+  rt_t* p = nullptr;
+
+  if((rc = destroy(hRef)) != kOkRC )
+    return rc;
+
+  if( rt_cfg == nullptr )
+    return rc;
+
+  p = new rt_t();
+
+  if((rc = rt_cfg->readv("mlockall_fl",       kOptFl, p->mlockall_fl,
+                         "mlock_future_fl",   kOptFl, p->mlock_future_fl,
+                         "prefault_stack_kb", kOptFl, p->prefault_stack_kb,
+                         "ftz_daz_fl",        kOptFl, p->ftz_daz_fl,
+                         "denorm_diag_fl",    kOptFl, p->denorm_diag_fl)) != kOkRC )
+  {
+    rc = cwLogError(rc,"The 'rt' cfg. record parse failed.");
+    goto errLabel;
+  }
+
+  // the prefault must stay well within the stack of the IO framework's threads
+  if( p->prefault_stack_kb > 1024 )
+  {
+    cwLogWarning("The 'rt.prefault_stack_kb' value %i was reduced to 1024.",p->prefault_stack_kb);
+    p->prefault_stack_kb = 1024;
+  }
+
+  if( kFtzDazMask == 0 && (p->ftz_daz_fl || p->denorm_diag_fl) )
+  {
+    cwLogWarning("The 'rt.ftz_daz_fl' and 'rt.denorm_diag_fl' settings are not supported on this processor.");
+    p->ftz_daz_fl     = false;
+    p->denorm_diag_fl = false;
+  }
+
+  if( p->denorm_diag_fl )
+    cwLogInfo("rt: the denormal diagnostic reads the audio thread's FP flags only - poly worker threads (parallel_fl:true) are not covered.");
+
+  if((rc = _parse_thread(p,kAudioThreadId,rt_cfg,"audio")) != kOkRC
+    || (rc = _parse_thread(p,kMidiThreadId,rt_cfg,"midi")) != kOkRC
+    || (rc = _parse_thread(p,kUiThreadId,rt_cfg,"ui")) != kOkRC )
+  {
+    goto errLabel;
+  }
+
+  // create() is called from the main thread before the UI settings are applied to it
+  p->default_fl = pthread_getschedparam(pthread_self(),&p->default_policy,&p->default_param) == 0
+    && pthread_getaffinity_np(pthread_self(),sizeof(p->default_cpuSet),&p->default_cpuSet) == 0;
+
+  hRef.set(p);
+
+errLabel:
+  if( rc != kOkRC )
+    delete p;
+
+  return rc;
+}
+
+cw::rc_t caw::rt::destroy( handle_t& hRef )
+{
+  if( !hRef.isValid() )
+    return kOkRC;
+
+  delete _handleToPtr(hRef);
+  hRef.clear();
+
+  return kOkRC;
+}
+
+void caw::rt::on_thread( handle_t h, unsigned threadId )
+{
+  if( !h.isValid() || threadId >= kThreadCnt || (t_appliedMask & (1u << threadId)) )
+    return;
+
+  t_appliedMask |= 1u << threadId;
+
+  rt_t*     p = _handleToPtr(h);
+  thread_t* t = p->threadA + threadId;
+
+  if( t->priority > 0 )
+  {
+    struct sched_param param = {};
+    param.sched_priority = t->priority;
+    t->sched_errno.store(pthread_setschedparam(pthread_self(),SCHED_FIFO,&param));
+  }
+
+  if( t->cpuN > 0 )
+    t->affinity_errno.store(pthread_setaffinity_np(pthread_self(),sizeof(t->cpuSet),&t->cpuSet));
+
+  // only the audio thread executes the flow graph
+  if( p->ftz_daz_fl && threadId == kAudioThreadId )
+  {
+    _fp_ctl_set(_fp_ctl_get() | kFtzDazMask);
+    t->ftz_daz_fl.store(true);
+  }
+
+  if( p->prefault_stack_kb > 0 )
+    _prefault_stack(p->prefault_stack_kb * 1024);
+
+  t->tid.store((int)syscall(SYS_gettid));
+  t->applyCnt.fetch_add(1);
+  t->state.store(kAppliedStateId,std::memory_order_release);
+}
+
+void caw::rt::reset_thread( handle_t h )
+{
+  if( !h.isValid() )
+    return;
+
+  rt_t*     p   = _handleToPtr(h);
+  thread_t* t   = p->threadA + kUiThreadId;
+  int       err = 0;
+
+  if( t->priority == 0 && t->cpuN == 0 )
+    return;
+
+  if( !p->default_fl )
+  {
+    cwLogWarning("rt: the default scheduling settings are not known - the thread (tid:%i) keeps the UI settings.",(int)syscall(SYS_gettid));
+    return;
+  }
+
+  if( t->priority > 0 && (err = pthread_setschedparam(pthread_self(),p->default_policy,&p->default_param)) != 0 )
+    cwLogWarning("rt: the scheduling class of thread (tid:%i) could not be reset. (%s)",(int)syscall(SYS_gettid),strerror(err));
+
+  if( t->cpuN > 0 && (err = pthread_setaffinity_np(pthread_self(),sizeof(p->default_cpuSet),&p->default_cpuSet)) != 0 )
+    cwLogWarning("rt: the cpu affinity of thread (tid:%i) could not be reset. (%s)",(int)syscall(SYS_gettid),strerror(err));
+}
+
+unsigned caw::rt::fp_env_begin( handle_t h )
+{
+  unsigned prev = _fp_ctl_get();
+
+  if( h.isValid() && _handleToPtr(h)->ftz_daz_fl )
+    _fp_ctl_set(prev | kFtzDazMask);
+
+  return prev;
+}
+
+void caw::rt::fp_env_end( handle_t h, unsigned prev )
+{
+  if( h.isValid() && _handleToPtr(h)->ftz_daz_fl )
+    _fp_ctl_set(prev);
+}
+
+void caw::rt::begin_cycle( handle_t h )
+{
+  if( !h.isValid() )
+    return;
+
+  rt_t* p = _handleToPtr(h);
+
+  if( !p->denorm_diag_fl )
+    return;
+
+  _fp_status_set(_fp_status_get() & ~(unsigned)(kDenormFlag | kUnderflowFlag));
+  time::get(p->cycle_t0);
+}
+
+void caw::rt::end_cycle( handle_t h )
+{
+  if( !h.isValid() )
+    return;
+
+  rt_t* p = _handleToPtr(h);
+
+  if( !p->denorm_diag_fl )
+    return;
+
+  unsigned  status = _fp_status_get();
+  unsigned  us     = time::elapsedMicros(p->cycle_t0);
+  denorm_t& d      = p->denorm;
+
+  d.cycleN.fetch_add(1,std::memory_order_relaxed);
+
+  if( status & kUnderflowFlag )
+    d.underflowCycleN.fetch_add(1,std::memory_order_relaxed);
+
+  if( status & kDenormFlag )
+  {
+    d.denormCycleN.fetch_add(1,std::memory_order_relaxed);
+    d.denormSumUs.fetch_add(us,std::memory_order_relaxed);
+    _update_max(d.denormMaxUs,us);
+  }
+  else
+  {
+    d.cleanSumUs.fetch_add(us,std::memory_order_relaxed);
+    _update_max(d.cleanMaxUs,us);
+  }
+}
+
+cw::rc_t caw::rt::lock_memory( handle_t h )
+{
+  rc_t rc = kOkRC;
+
+  if( !h.isValid() )
+    return rc;
+
+  rt_t* p = _handleToPtr(h);
+
+  if( !p->mlockall_fl )
+    return rc;
+
+  if( mlockall(MCL_CURRENT | (p->mlock_future_fl ? MCL_FUTURE : 0)) != 0 )
+  {
+    int err = errno;
+    cwLogWarning("rt: mlockall() failed. (%s)%s",strerror(err),
+                 err==ENOMEM || err==EPERM ? " (check the 'memlock' limit in /etc/security/limits.conf)" : "");
+  }
+  else
+  {
+    if( !p->locked_fl )
+      cwLogInfo("rt: process memory locked.");
+    p->locked_fl = true;
+  }
+
+  return rc;
+}
+
+void caw::rt::exec( handle_t h )
+{
+  if( !h.isValid() )
+    return;
+
+  rt_t* p = _handleToPtr(h);
+
+  for(unsigned i=0; i<kThreadCnt; ++i)
+  {
+    thread_t* t = p->threadA + i;
+    unsigned  s = kAppliedStateId;
+
+    if( !t->state.compare_exchange_strong(s,kReportedStateId,std::memory_order_acquire) )
+      continue;
+
+    int sched_err    = t->sched_errno.load();
+    int affinity_err = t->affinity_errno.load();
+
+    if( t->priority > 0 )
+    {
+      if( sched_err == 0 )
+        cwLogInfo("rt: %s thread (tid:%i) SCHED_FIFO priority:%i.",t->label,t->tid.load(),t->priority);
+      else
+        cwLogWarning("rt: %s thread (tid:%i) SCHED_FIFO priority:%i failed. (%s)%s",t->label,t->tid.load(),t->priority,strerror(sched_err),_errno_hint(sched_err));
+    }
+
+    if( t->cpuN > 0 )
+    {
+      if( affinity_err == 0 )
+        cwLogInfo("rt: %s thread (tid:%i) pinned to %i cpu(s).",t->label,t->tid.load(),t->cpuN);
+      else
+        cwLogWarning("rt: %s thread (tid:%i) cpu affinity failed. (%s)",t->label,t->tid.load(),strerror(affinity_err));
+    }
+
+    if( t->ftz_daz_fl.load() )
+      cwLogInfo("rt: %s thread (tid:%i) FTZ/DAZ set.",t->label,t->tid.load());
+  }
+
+  // log the onset of denormal cycles once per minute at most
+  if( p->denorm_diag_fl && p->denorm.denormCycleN.load(std::memory_order_relaxed) != p->denorm_logN )
+  {
+    if( p->denorm_logN == 0 || time::elapsedMicros(p->denorm_log_t) >= 60000000ull )
+    {
+      p->denorm_logN = p->denorm.denormCycleN.load(std::memory_order_relaxed);
+      cwLogWarning("rt: %s on the audio thread in %i of %i cycles.",kDenormLabel,p->denorm_logN,p->denorm.cycleN.load(std::memory_order_relaxed));
+      time::get(p->denorm_log_t);
+    }
+  }
+}
+
+void caw::rt::report( handle_t h )
+{
+  if( !h.isValid() )
+    return;
+
+  rt_t* p = _handleToPtr(h);
+
+  cwLogPrint("rt: mlockall:%s future:%s locked:%s prefault_stack_kb:%i ftz_daz:%s\n",
+             p->mlockall_fl ? "yes" : "no", p->mlock_future_fl ? "yes" : "no", p->locked_fl ? "yes" : "no", p->prefault_stack_kb,
+             p->ftz_daz_fl ? "yes" : "no");
+
+  for(unsigned i=0; i<kThreadCnt; ++i)
+  {
+    const thread_t* t = p->threadA + i;
+
+    cwLogPrint("rt: %-5s priority:%2i cpus:%2i threads:%i tid:%i sched:%s affinity:%s\n",
+               t->label, t->priority, t->cpuN, t->applyCnt.load(), t->tid.load(),
+               t->priority==0 ? "-" : t->sched_errno.load()==0 ? "ok" : strerror(t->sched_errno.load()),
+               t->cpuN==0     ? "-" : t->affinity_errno.load()==0 ? "ok" : strerror(t->affinity_errno.load()));
+  }
+
+  if( p->denorm_diag_fl )
+  {
+    const denorm_t& d        = p->denorm;
+    unsigned        denormN  = d.denormCycleN.load();
+    unsigned        cleanN   = d.cycleN.load() - denormN;
+
+    cwLogPrint("rt: audio thread cycles with %s:%i of %i underflow cycles:%i (poly worker threads are not covered)\n", kDenormLabel, denormN, d.cycleN.load(), d.underflowCycleN.load());
+    cwLogPrint("rt: exec us - denormal cycles avg:%.1f max:%i  other cycles avg:%.1f max:%i\n",
+               denormN==0 ? 0.0 : (double)d.denormSumUs.load()/denormN, d.denormMaxUs.load(),
+               cleanN==0  ? 0.0 : (double)d.cleanSumUs.load()/cleanN,   d.cleanMaxUs.load());
+  }
+}
@@ -0,0 +1,81 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#ifndef cawRt_h
+#define cawRt_h
+
+// Real-time thread and memory configuration (program cfg. 'rt' record).
+//
+// The audio, MIDI and UI threads are created by the IO framework so each thread
+// applies its own settings: on_thread() is called at the top of the thread's
+// callback and, on the first call from a given thread, sets the SCHED_FIFO priority
+// and the CPU affinity and prefaults 'prefault_stack_kb' of the thread's stack.
+// on_thread() does not allocate or log. The results are logged by exec() which is
+// called from the main loop.
+//
+// The UI thread is the main thread. Threads created by the main thread after the UI
+// settings are applied inherit its priority and affinity, so threads which caw creates
+// from it (e.g. the program loader) call reset_thread() first. Threads those threads
+// create (prefetch readers, poly network workers) then inherit the default settings.
+//
+// lock_memory() calls mlockall() and is called after each program is initialized
+// so that the program's buffers are resident before it runs.
+//
+// If 'ftz_daz_fl' is set the audio thread sets the flush-to-zero and denormals-are-zero
+// modes in on_thread(). Threads created while a program is initialized (e.g. the
+// workers of a poly network) inherit the FP environment of the creating thread, so
+// program initialize is bracketed by fp_env_begin()/fp_env_end().
+//
+// If 'denorm_diag_fl' is set begin_cycle()/end_cycle() clear and then read the FP
+// status flags around each exec cycle and count the cycles which used a denormal
+// operand along with their exec time. Run with 'ftz_daz_fl' off to find out whether a
+// program produces denormals. On aarch64 the input denormal flag (FPSR.IDC) is only set
+// when flush-to-zero is on, so the cycles which produce a denormal result (FPSR.UFC)
+// are counted instead. The FP status flags are per thread and only the audio thread's
+// flags are read. Work done by the worker threads of a parallel poly network is not
+// covered - run the program with parallel_fl:false to diagnose it.
+//
+// Settings which fail because of missing permissions (CAP_SYS_NICE, 'rtprio' or
+// 'memlock' limits) are reported but are not errors.
+
+namespace caw
+{
+  namespace rt
+  {
+    typedef cw::handle<struct rt_str> handle_t;
+
+    enum {
+      kAudioThreadId,
+      kMidiThreadId,
+      kUiThreadId,
+      kThreadCnt
+    };
+
+    cw::rc_t create( handle_t& hRef, const cw::object_t* rt_cfg );
+    cw::rc_t destroy( handle_t& hRef );
+
+    // Called from the thread identified by 'threadId' (kAudioThreadId, ...).
+    void on_thread( handle_t h, unsigned threadId );
+
+    // Restore the process's default scheduling class and cpu affinity on the calling thread.
+    void reset_thread( handle_t h );
+
+    // Set FTZ/DAZ on the calling thread if 'ftz_daz_fl' is set and return the previous FP control word.
+    unsigned fp_env_begin( handle_t h );
+    void     fp_env_end( handle_t h, unsigned prev );
+
+    // Denormal diagnostic. Called from the audio thread before and after the flow graph is executed.
+    void begin_cycle( handle_t h );
+    void end_cycle( handle_t h );
+
+    // Lock the process memory. (Called after program initialize.)
+    cw::rc_t lock_memory( handle_t h );
+
+    // Log the result of the thread settings applied since the last call. (Main thread)
+    void exec( handle_t h );
+
+    // Print the settings and their results.
+    void report( handle_t h );
+  }
+}
+
+#endif
@@ -0,0 +1,281 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#include "cwCommon.h"
+#include "cwLog.h"
+#include "cwCommonImpl.h"
+#include "cwMem.h"
+#include "cwTime.h"
+
+#include "cawTrace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace cw;
+
+namespace caw {
+
+  namespace trace {
+
+    typedef unsigned long long u64_t;
+
+    typedef struct span_label_str
+    {
+      spanId_t    spanId;
+      const char* label;        // event name
+      const char* thread_label; // name given to the thread which records this span
+    } span_label_t;
+
+    span_label_t _spanLabelA[] = {
+      { kAudioCbSpanId,     "audio_cb",     "audio"   },
+      { kFlowExecSpanId,    "flow_exec",    "audio"   },
+      { kPgmLoadSpanId,     "pgm_load",     "control" },
+      { kPgmInitSpanId,     "pgm_init",     "control" },
+      { kPresetApplySpanId, "preset_apply", "control" },
+      { kUiMsgSpanId,       "ui_msg",       "ui"      },
+      { kSpanCnt,           nullptr,        nullptr   }
+    };
+
+    typedef struct span_str
+    {
+      std::atomic<u64_t> seq;     // span index + 1 when the record is complete, 0 while it is being written
+      u64_t              t0_ns;   // start time relative to the creation of the recorder
+      u64_t              dur_ns;
+      unsigned           spanId;
+      unsigned           arg;
+      unsigned           tid;
+    } span_t;
+
+    typedef struct trace_str
+    {
+      span_t*               spanA;     // spanA[ spanN ]
+      unsigned              spanN;
+      bool                  ringFl;    // overwrite the oldest spans when spanA[] is full
+      std::atomic<u64_t>    nextIdx;   // index of the next span to write
+      std::atomic<unsigned> dropCnt;   // count of spans dropped because spanA[] was full
+      std::atomic<unsigned> missCnt;   // count of audio callbacks which overran their budget
+      std::atomic<bool>     activeFl;
+      u64_t                 base_ns;   // creation time
+    } trace_t;
+
+    trace_t* _handleToPtr( handle_t h )
+    { return handleToPtr<handle_t,trace_t>(h); }
+
+    u64_t _now_ns()
+    {
+      time::spec_t t;
+      time::get(t);
+      return (u64_t)t.tv_sec * 1000000000ull + (u64_t)t.tv_nsec;
+    }
+
+    unsigned _thread_id()
+    {
+      thread_local unsigned tid = (unsigned)syscall(SYS_gettid);
+      return tid;
+    }
+
+    void _record( trace_t* p, spanId_t spanId, u64_t t0, u64_t t1, unsigned arg )
+    {
+      u64_t idx = p->nextIdx.fetch_add(1,std::memory_order_relaxed);
+
+      if( idx >= p->spanN && !p->ringFl )
+      {
+        p->dropCnt.fetch_add(1,std::memory_order_relaxed);
+        return;
+      }
+
+      // the per-span sequence number lets a reader detect a record which is being overwritten
+      span_t* s = p->spanA + (idx % p->spanN);
+      s->seq.store(0,std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      s->t0_ns  = t0 - p->base_ns;
+      s->dur_ns = t1 - t0;
+      s->spanId = spanId;
+      s->arg    = arg;
+      s->tid    = _thread_id();
+      s->seq.store(idx+1,std::memory_order_release);
+    }
+
+    // Copy the span with index 'idx' - return false if it was overwritten or is incomplete.
+    bool _read( trace_t* p, u64_t idx, span_t& r )
+    {
+      const span_t* s  = p->spanA + (idx % p->spanN);
+      u64_t         s0 = s->seq.load(std::memory_order_acquire);
+
+      r.t0_ns  = s->t0_ns;
+      r.dur_ns = s->dur_ns;
+      r.spanId = s->spanId;
+      r.arg    = s->arg;
+      r.tid    = s->tid;
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      return s0 == idx+1 && s->seq.load(std::memory_order_relaxed) == s0 && r.spanId < kSpanCnt;
+    }
+
+    rc_t _destroy( trace_t*& p )
+    {
+      if( p != nullptr )
+      {
+        mem::release(p->spanA);
+        mem::release(p);
+      }
+      return kOkRC;
+    }
+  }
+}
+
+cw::rc_t caw::trace::create( handle_t& hRef, unsigned spanCnt, bool ringFl, bool activeFl )
+{
+  rc_t     rc;
+  trace_t* p = nullptr;
+
+  if((rc = destroy(hRef)) != kOkRC )
+    return rc;
+
+  if( spanCnt == 0 )
+    return cwLogError(kInvalidArgRC,"The trace span count must be greater than zero.");
+
+  p          = mem::allocZ<trace_t>();
+  p->spanA   = mem::allocZ<span_t>(spanCnt);
+  p->spanN   = spanCnt;
+  p->ringFl  = ringFl;
+  p->base_ns = _now_ns();
+  p->activeFl.store(activeFl);
+
+  hRef.set(p);
+
+  return rc;
+}
+
+cw::rc_t caw::trace::destroy( handle_t& hRef )
+{
+  rc_t rc = kOkRC;
+
+  if( !hRef.isValid() )
+    return rc;
+
+  trace_t* p = _handleToPtr(hRef);
+
+  if((rc = _destroy(p)) != kOkRC )
+    return cwLogError(rc,"Trace destroy failed.");
+
+  hRef.clear();
+
+  return rc;
+}
+
+void caw::trace::set_active( handle_t h, bool activeFl )
+{
+  if( h.isValid() )
+    _handleToPtr(h)->activeFl.store(activeFl);
+}
+
+bool caw::trace::is_active( handle_t h )
+{
+  return h.isValid() && _handleToPtr(h)->activeFl.load(std::memory_order_relaxed);
+}
+
+unsigned long long caw::trace::begin( handle_t h )
+{
+  if( !is_active(h) )
+    return 0;
+
+  return _now_ns();
+}
+
+void caw::trace::end( handle_t h, spanId_t spanId, unsigned long long t0, unsigned arg )
+{
+  // the recorder was not active when the span started
+  if( t0 == 0 || !h.isValid() )
+    return;
+
+  _record(_handleToPtr(h),spanId,t0,_now_ns(),arg);
+}
+
+void caw::trace::end_cycle( handle_t h, unsigned long long t0, double budget_us )
+{
+  if( t0 == 0 || !h.isValid() )
+    return;
+
+  trace_t* p  = _handleToPtr(h);
+  u64_t    t1 = _now_ns();
+
+  _record(p,kAudioCbSpanId,t0,t1,kInvalidId);
+
+  if( budget_us > 0 && (t1 - t0) > budget_us * 1000.0 )
+    p->missCnt.fetch_add(1,std::memory_order_relaxed);
+}
+
+unsigned caw::trace::deadline_miss_count( handle_t h )
+{
+  return h.isValid() ? _handleToPtr(h)->missCnt.load(std::memory_order_relaxed) : 0;
+}
+
+cw::rc_t caw::trace::write_json( handle_t h, const char* fname )
+{
+  rc_t     rc    = kOkRC;
+  trace_t* p     = _handleToPtr(h);
+  u64_t    eIdx  = p->nextIdx.load(std::memory_order_acquire);
+  u64_t    bIdx  = eIdx > p->spanN ? eIdx - p->spanN : 0;
+  unsigned pid   = (unsigned)getpid();
+  unsigned tidA[ 32 ];
+  unsigned tidN  = 0;
+  unsigned n     = 0;
+  FILE*    fp;
+
+  if( !p->ringFl )
+    eIdx = std::min(eIdx,(u64_t)p->spanN);
+
+  if((fp = fopen(fname,"w")) == nullptr )
+    return cwLogError(kOpenFailRC,"The trace file '%s' could not be created.",cwStringNullGuard(fname));
+
+  fprintf(fp,"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+  for(u64_t i=bIdx; i<eIdx; ++i)
+  {
+    span_t r;
+
+    if( !_read(p,i,r) )
+      continue;
+
+    n += 1;
+
+    // name each thread after the first span recorded by it
+    unsigned j = 0;
+    for(; j<tidN; ++j)
+      if( tidA[j] == r.tid )
+        break;
+
+    if( j == tidN && tidN < 32 )
+    {
+      tidA[ tidN++ ] = r.tid;
+      fprintf(fp,"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}},\n",
+              pid, r.tid, _spanLabelA[ r.spanId ].thread_label );
+    }
+
+    fprintf(fp,"{\"name\":\"%s\",\"cat\":\"caw\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u",
+            _spanLabelA[ r.spanId ].label, r.t0_ns/1000.0, r.dur_ns/1000.0, pid, r.tid );
+
+    if( r.arg != kInvalidId )
+      fprintf(fp,",\"args\":{\"id\":%u}",r.arg);
+
+    fprintf(fp,"},\n");
+  }
+
+  // the trailing metadata event avoids a dangling comma
+  fprintf(fp,"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":0,\"args\":{\"name\":\"caw\"}}\n",pid);
+  fprintf(fp,"]}\n");
+
+  fclose(fp);
+
+  if( p->dropCnt.load() > 0 )
+    cwLogWarning("%i trace spans were dropped because the trace buffer was full (%i spans).",p->dropCnt.load(),p->spanN);
+
+  cwLogInfo("%i trace spans written to '%s'.",n,fname);
+
+  return rc;
+}
@@ -0,0 +1,60 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#ifndef cawTrace_h
+#define cawTrace_h
+
+// Lock-free span recorder with Chrome trace-event (Perfetto) JSON export.
+//
+// Any thread may record a span by calling begin() and end(). Spans are written
+// into a pre-allocated array with a single atomic increment so recording is safe
+// from the audio thread. write_json() produces a file which can be opened
+// with chrome://tracing or https://ui.perfetto.dev.
+//
+// In 'ring' (flight recorder) mode the array wraps around and holds the most
+// recent spans. write_json() may then be called while recording continues.
+// end_cycle() counts the audio callbacks which overran their real-time budget
+// so that the application can dump the recorder after a deadline miss.
+
+namespace caw
+{
+  namespace trace
+  {
+    typedef cw::handle<struct trace_str> handle_t;
+
+    typedef enum {
+      kAudioCbSpanId,      // io::kAudioTId callback
+      kFlowExecSpanId,     // io_flow_ctl::exec()
+      kPgmLoadSpanId,      // io_flow_ctl::program_load()
+      kPgmInitSpanId,      // io_flow_ctl::program_initialize()
+      kPresetApplySpanId,  // io_flow_ctl::program_apply_preset()
+      kUiMsgSpanId,        // io::kUiTId callback
+      kSpanCnt
+    } spanId_t;
+
+    // spanCnt is the max. count of spans which can be recorded.
+    // If ringFl is set the oldest spans are overwritten when the array is full, otherwise new spans are dropped.
+    cw::rc_t create( handle_t& hRef, unsigned spanCnt, bool ringFl, bool activeFl );
+    cw::rc_t destroy( handle_t& hRef );
+
+    // Start/stop recording.
+    void set_active( handle_t h, bool activeFl );
+    bool is_active( handle_t h );
+
+    // Return a start time to pass to end() or 0 if the recorder is not active.
+    unsigned long long begin( handle_t h );
+
+    // Record a span which started at t0. 'arg' is shown in the event details (e.g. a UI element id).
+    void end( handle_t h, spanId_t spanId, unsigned long long t0, unsigned arg=cw::kInvalidId );
+
+    // Record a kAudioCbSpanId span and count a deadline miss if it took longer than budget_us.
+    void end_cycle( handle_t h, unsigned long long t0, double budget_us );
+
+    // Count of audio callbacks which overran their budget since the recorder was created.
+    unsigned deadline_miss_count( handle_t h );
+
+    // Write the recorded spans as Chrome trace-event JSON.
+    cw::rc_t write_json( handle_t h, const char* fname );
+  }
+}
+
+#endif
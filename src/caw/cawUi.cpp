@@ -36,12 +36,25 @@ namespace caw {
       kRowVarLayoutId
     };
     
+    typedef struct widget_str
+    {
+      unsigned              uuId;
+      unsigned              widget_type_id; // kCheckWidgetId, kIntWidgetId, ...
+      const flow::ui_var_t* ui_var;
+      bool                  echo_fl;        // an echo of this widget's value is pending
+    } widget_t;
+    
     typedef struct ui_str
     {
       io::handle_t              ioH;
       io_flow_ctl::handle_t     ioFlowH;
       const flow::ui_net_t*     ui_net;
       unsigned                  ui_net_idx;
+
+      widget_t*                 widgetA;      // widgetA[ widgetAllocN ] variable widgets sorted on uuId
+      unsigned                  widgetN;
+      unsigned                  widgetAllocN;
+      unsigned                  echoN;        // count of widgets with echo_fl set
       
     } ui_t;
 
@@ -64,10 +77,88 @@ namespace caw {
 
       }
       
+      if( p != nullptr )
+        mem::release(p->widgetA);
+      
       mem::release(p);
       return rc;
     }
 
+    void _insert_widget( ui_t* p, unsigned uuId, unsigned widget_type_id, const flow::ui_var_t* ui_var )
+    {
+      if( p->widgetN == p->widgetAllocN )
+      {
+        p->widgetAllocN = p->widgetAllocN==0 ? 64 : p->widgetAllocN*2;
+        p->widgetA      = mem::resizeZ<widget_t>(p->widgetA,p->widgetAllocN);
+      }
+
+      // uuId's are usually allocated in increasing order so this rarely moves anything
+      unsigned i = p->widgetN;
+      for(; i>0 && p->widgetA[i-1].uuId > uuId; --i)
+        p->widgetA[i] = p->widgetA[i-1];
+      
+      p->widgetA[ i ].uuId           = uuId;
+      p->widgetA[ i ].widget_type_id = widget_type_id;
+      p->widgetA[ i ].ui_var         = ui_var;
+      p->widgetA[ i ].echo_fl        = false;
+      p->widgetN += 1;
+    }
+
+    widget_t* _find_widget( ui_t* p, unsigned uuId )
+    {
+      unsigned bi = 0;
+      unsigned ei = p->widgetN;
+      
+      while( bi < ei )
+      {
+        unsigned mi = bi + (ei-bi)/2;
+        
+        if( p->widgetA[mi].uuId == uuId )
+          return p->widgetA + mi;
+
+        if( p->widgetA[mi].uuId < uuId )
+          bi = mi + 1;
+        else
+          ei = mi;
+      }
+      
+      return nullptr;
+    }
+
+    template< typename T >
+    rc_t _send_widget_value( ui_t* p, const widget_t* w )
+    {
+      rc_t rc;
+      T    value = 0;
+      
+      if((rc = get_variable_value( p->ioFlowH, w->ui_var, value )) != kOkRC )
+        return cwLogError(rc,"Unable to access the value of '%s:%i'.",cwStringNullGuard(w->ui_var->label),w->ui_var->label_sfx_id);
+
+      return uiSendValue( p->ioH, w->uuId, value );
+    }
+
+    rc_t _send_widget( ui_t* p, const widget_t* w )
+    {
+      rc_t rc = kOkRC;
+      
+      switch( w->widget_type_id )
+      {
+        case kCheckWidgetId:  rc = _send_widget_value<bool>(p,w);        break;
+        case kIntWidgetId:    rc = _send_widget_value<int>(p,w);         break;
+        case kUIntWidgetId:   rc = _send_widget_value<unsigned>(p,w);    break;
+        case kFloatWidgetId:  rc = _send_widget_value<float>(p,w);       break;
+        case kDoubleWidgetId: rc = _send_widget_value<double>(p,w);      break;
+        case kStringWidgetId: rc = _send_widget_value<const char*>(p,w); break;
+        case kListWidgetId:   rc = _send_widget_value<unsigned>(p,w);    break;
+          
+        default:
+          // buttons have no value and meters are updated by the network
+          break;
+      }
+      
+      return rc;
+    }
+
     rc_t _create_bool_widget( ui_t* p, unsigned widgetListUuId, const flow::ui_var_t* ui_var, const char* title, unsigned& uuid_ref )
     {
       rc_t rc = kOkRC;
@@ -372,6 +463,8 @@ namespace caw {
       {
         uiSetBlob(p->ioH,widget_uuId, &ui_var, sizeof(&ui_var));
 
+        _insert_widget(p, widget_uuId, widget_type_id, ui_var );
+
         // if this is a 'init' variable or connected to a source variable then disable it
         // (The UI should not be able to change the value of a var. that is being set by a source in the network.)
         if( ui_var->disable_fl)
@@ -742,3 +835,45 @@ cw::rc_t caw::ui::destroy( handle_t& hRef )
   
   return rc;  
 }
+
+cw::rc_t caw::ui::echo( handle_t h, unsigned uuId )
+{
+  ui_t*     p = _handleToPtr(h);
+  widget_t* w;
+  
+  if((w = _find_widget(p,uuId)) == nullptr )
+    return kEleNotFoundRC;
+
+  if( !w->echo_fl )
+  {
+    w->echo_fl = true;
+    p->echoN  += 1;
+  }
+  
+  return kOkRC;
+}
+
+cw::rc_t caw::ui::exec_echo( handle_t h )
+{
+  rc_t  rc = kOkRC;
+  ui_t* p  = nullptr;
+
+  if( !h.isValid() )
+    return rc;
+
+  p = _handleToPtr(h);
+  
+  for(unsigned i=0; i<p->widgetN && p->echoN>0; ++i)
+    if( p->widgetA[i].echo_fl )
+    {
+      rc_t rc0;
+      
+      p->widgetA[i].echo_fl = false;
+      p->echoN             -= 1;
+
+      if((rc0 = _send_widget( p, p->widgetA + i )) != kOkRC )
+        rc = cwLogError(rc0,"Echo failed for '%s:%i'-'%s:%i'.",cwStringNullGuard(p->widgetA[i].ui_var->ui_proc->label),p->widgetA[i].ui_var->ui_proc->label_sfx_id,cwStringNullGuard(p->widgetA[i].ui_var->label),p->widgetA[i].ui_var->label_sfx_id);
+    }
+
+  return rc;
+}
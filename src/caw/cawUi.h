@@ -10,12 +10,22 @@ namespace caw
   {
     typedef cw::handle<struct ui_str> handle_t;
 
+    // Create the network panel and its variable widget table. The table is not locked:
+    // create(), destroy(), echo() and exec_echo() must all be called from the UI thread.
     cw::rc_t create( handle_t& hRef,
                      cw::io::handle_t ioH,
                      cw::io_flow_ctl::handle_t ioFlowH,
                      const cw::flow::ui_net_t* ui_net);
 
     cw::rc_t destroy( handle_t& hRef );
+
+    // Mark a variable widget as needing its value echoed to the UI. Repeated requests for the
+    // same widget are merged. Returns kEleNotFoundRC if 'uuId' is not a variable widget.
+    cw::rc_t echo( handle_t h, unsigned uuId );
+
+    // Send the values of all the widgets marked by echo() in one pass over the network's variables.
+    // Called once per UI cycle after the incoming UI messages have been processed.
+    cw::rc_t exec_echo( handle_t h );
   }
 }
 
@@ -12,6 +12,8 @@ namespace caw {
       kNetPrintBtnId,
       kReportBtnId,  
       kLatencyBtnId,
+      kTraceCheckId,
+      kTraceDumpBtnId,
 
       kReloadIoBtnId,
       kReloadPgmBtnId,
@@ -23,6 +25,8 @@ namespace caw {
       kRunCheckId,
 
       kLogId,
+      kMeterListId,
+      kSyncSeqId,
     
       kRootNetPanelId,
       kNetListId,
@@ -50,6 +54,7 @@ namespace caw {
       kStringWidgetId,
       kMeterWidgetId,
       kListWidgetId,
+      kDevMeterId,
       
 
       kPgmBaseSelId,
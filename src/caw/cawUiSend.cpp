@@ -0,0 +1,516 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#include "cwCommon.h"
+#include "cwLog.h"
+#include "cwCommonImpl.h"
+#include "cwMem.h"
+#include "cwObject.h"
+#include "cwTime.h"
+#include "cwMidiDecls.h"
+#include "cwIo.h"
+
+#include "cawUiSend.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+using namespace cw;
+
+namespace caw {
+
+  namespace ui_send {
+
+    typedef unsigned long long u64_t;
+
+    enum {
+      kMaxSessN      = 16,
+      kValueByteCnt  = 64,  // approx. size of a JSON value message
+      kLogByteCnt    = 48   // approx. size of a JSON log message without the text
+    };
+
+    typedef struct value_str
+    {
+      unsigned uuId;
+      double   value;
+      bool     pendingFl;
+    } value_t;
+
+    typedef struct sess_str
+    {
+      bool         validFl;
+      unsigned     wsSessId;
+      unsigned     echoSeqId;   // last sequence number echoed by this session
+      time::spec_t echo_time;   // time of the last echo (or of the connection)
+      bool         echoFl;      // the session has echoed at least once
+      bool         lagFl;       // the session is lagging
+      bool         ignoreFl;    // the session has not echoed within sync_timeout_ms
+      unsigned     max_lag_ms;
+    } sess_t;
+
+    typedef struct ui_send_str
+    {
+      io::handle_t   ioH;
+      unsigned       syncAppId;
+      unsigned       syncUuId;    // sequence number element (resolved on the first ping)
+      args_t         args;
+
+      value_t*       valueA;      // valueA[ valueN ] latest value of each element
+      unsigned       valueN;
+      unsigned       flushIdx;    // first element to check on the next flush
+
+      std::mutex     logMutex;    // guards logA[] and the log counters
+      char**         logA;        // logA[ args.maxLogLineCnt ] ring of queued log lines
+      unsigned       logUuId;     // log element
+      unsigned       logHead;
+      unsigned       logTail;
+      u64_t          log_drop_cnt;
+      unsigned       log_drop_note_cnt; // count of dropped lines not yet reported to the UI
+
+      sess_t         sessA[ kMaxSessN ];
+      unsigned       seqId;
+      time::spec_t   ping_time;
+      time::spec_t   exec_time;
+      time::spec_t   note_time;      // time of the last dropped line report
+      double         byte_tokens;    // available byte budget
+      double         line_tokens;    // available log line budget while lagging
+      bool           lagFl;
+      bool           congestedFl;
+
+      u64_t          value_cnt;
+      u64_t          coalesce_cnt;
+      u64_t          value_send_cnt;
+      u64_t          log_send_cnt;
+      u64_t          byte_cnt;
+    } ui_send_t;
+
+    ui_send_t* _handleToPtr( handle_t h )
+    { return handleToPtr<handle_t,ui_send_t>(h); }
+
+    rc_t _destroy( ui_send_t*& p )
+    {
+      if( p != nullptr )
+      {
+        for(unsigned i=0; i<p->args.maxLogLineCnt; ++i)
+          mem::release(p->logA[i]);
+
+        mem::release(p->logA);
+        mem::release(p->valueA);
+        delete p;
+        p = nullptr;
+      }
+      return kOkRC;
+    }
+
+    sess_t* _find_sess( ui_send_t* p, unsigned wsSessId )
+    {
+      for(unsigned i=0; i<kMaxSessN; ++i)
+        if( p->sessA[i].validFl && p->sessA[i].wsSessId == wsSessId )
+          return p->sessA + i;
+      return nullptr;
+    }
+
+    unsigned _sess_lag_ms( const ui_send_t* p, const sess_t* s )
+    { return (p->seqId - s->echoSeqId) * p->args.ping_period_ms; }
+
+    void _update_lag( ui_send_t* p, const time::spec_t& now )
+    {
+      bool lagFl = false;
+
+      for(unsigned i=0; i<kMaxSessN; ++i)
+        if( p->sessA[i].validFl )
+        {
+          sess_t*  s        = p->sessA + i;
+          bool     ignoreFl = time::elapsedMicros(s->echo_time,now) >= p->args.sync_timeout_ms * 1000ull;
+          unsigned lag_ms   = _sess_lag_ms(p,s);
+
+          if( ignoreFl != s->ignoreFl )
+          {
+            if( ignoreFl )
+              cwLogWarning("UI session %i %s the sync sequence for %i ms - it is not used to throttle the UI.",
+                           s->wsSessId, s->echoFl ? "stopped echoing" : "has not echoed", p->args.sync_timeout_ms);
+            s->ignoreFl = ignoreFl;
+          }
+
+          if( s->ignoreFl )
+            continue;
+
+          s->max_lag_ms = std::max(s->max_lag_ms,lag_ms);
+
+          if( (lag_ms > p->args.lag_thresh_ms) != s->lagFl )
+          {
+            s->lagFl = !s->lagFl;
+            cwLogWarning("UI session %i %s (lag:%i ms).",s->wsSessId,s->lagFl ? "is lagging" : "caught up",lag_ms);
+          }
+
+          lagFl = lagFl || s->lagFl;
+        }
+
+      if( lagFl != p->lagFl )
+        cwLogWarning("UI %s log lines and meters.",lagFl ? "throttling" : "restoring");
+
+      p->lagFl = lagFl;
+    }
+
+    // Pop the oldest queued log line or return nullptr if the queue is empty.
+    char* _pop_log_line( ui_send_t* p )
+    {
+      std::lock_guard<std::mutex> lock(p->logMutex);
+      char* s = nullptr;
+
+      if( p->logHead != p->logTail )
+      {
+        s = p->logA[ p->logTail ];
+        p->logA[ p->logTail ] = nullptr;
+        p->logTail = (p->logTail + 1) % p->args.maxLogLineCnt;
+      }
+      return s;
+    }
+
+    rc_t _send_log_line( ui_send_t* p, const char* text )
+    {
+      rc_t rc;
+      if((rc = uiSetLogLine( p->ioH, p->logUuId, text )) == kOkRC )
+      {
+        unsigned byteN  = kLogByteCnt + strlen(text);
+        p->byte_tokens -= byteN;
+        p->byte_cnt    += byteN;
+        p->log_send_cnt += 1;
+      }
+      return rc;
+    }
+
+    rc_t _flush_log( ui_send_t* p, const time::spec_t& now )
+    {
+      rc_t rc = kOkRC;
+
+      while( p->byte_tokens > 0 )
+      {
+        char* s;
+        if((s = _pop_log_line(p)) == nullptr )
+          break;
+
+        if( p->lagFl )
+        {
+          if( p->line_tokens < 1 )
+          {
+            std::lock_guard<std::mutex> lock(p->logMutex);
+            p->log_drop_cnt      += 1;
+            p->log_drop_note_cnt += 1;
+            mem::release(s);
+            continue;
+          }
+
+          p->line_tokens -= 1;
+        }
+
+        // report the dropped lines - at most once per second while lagging
+        if( !p->lagFl || time::elapsedMicros(p->note_time,now) >= 1000000 )
+        {
+          unsigned dropN = 0;
+          {
+            std::lock_guard<std::mutex> lock(p->logMutex);
+            dropN = p->log_drop_note_cnt;
+            p->log_drop_note_cnt = 0;
+          }
+
+          if( dropN > 0 )
+          {
+            char buf[80];
+            snprintf(buf,sizeof(buf),"... %i log lines were dropped because the UI was lagging ...\n",dropN);
+            rc           = _send_log_line(p,buf);
+            p->note_time = now;
+          }
+        }
+
+        if( rc == kOkRC )
+          rc = _send_log_line(p,s);
+
+        mem::release(s);
+
+        if( rc != kOkRC )
+          break;
+      }
+
+      return rc;
+    }
+
+    rc_t _flush_values( ui_send_t* p, bool& pendingFl_ref )
+    {
+      rc_t rc = kOkRC;
+
+      pendingFl_ref = false;
+
+      // start where the last flush stopped so that no element is starved
+      for(unsigned k=0; k<p->valueN; ++k)
+      {
+        unsigned i = (p->flushIdx + k) % p->valueN;
+        value_t* v = p->valueA + i;
+
+        if( !v->pendingFl )
+          continue;
+
+        if( p->byte_tokens <= 0 )
+        {
+          pendingFl_ref = true;
+          p->flushIdx   = i;
+          break;
+        }
+
+        if((rc = uiSendValue( p->ioH, v->uuId, v->value )) != kOkRC )
+        {
+          rc = cwLogError(rc,"UI value send failed.");
+          break;
+        }
+
+        v->pendingFl       = false;
+        p->byte_tokens    -= kValueByteCnt;
+        p->byte_cnt       += kValueByteCnt;
+        p->value_send_cnt += 1;
+      }
+
+      return rc;
+    }
+  }
+}
+
+void caw::ui_send::default_args( args_t& args )
+{
+  args.byte_per_sec          = 256*1024;
+  args.ping_period_ms        = 250;
+  args.lag_thresh_ms         = 1000;
+  args.lag_log_lines_per_sec = 10;
+  args.sync_timeout_ms       = 10000;
+  args.maxValueCnt           = 256;
+  args.maxLogLineCnt         = 256;
+}
+
+cw::rc_t caw::ui_send::create( handle_t& hRef, io::handle_t ioH, unsigned syncAppId, const args_t& args )
+{
+  rc_t       rc;
+  ui_send_t* p = nullptr;
+
+  if((rc = destroy(hRef)) != kOkRC )
+    return rc;
+
+  if( args.byte_per_sec == 0 || args.ping_period_ms == 0 || args.maxValueCnt == 0 || args.maxLogLineCnt < 2 )
+    return cwLogError(kInvalidArgRC,"The UI send byte rate, ping period and queue sizes must be non-zero.");
+
+  if( args.sync_timeout_ms <= args.lag_thresh_ms )
+    return cwLogError(kInvalidArgRC,"The UI send 'sync_timeout_ms' (%i) must be greater than 'lag_thresh_ms' (%i).",args.sync_timeout_ms,args.lag_thresh_ms);
+
+  // the mutex is not trivially constructible
+  p              = new ui_send_t();
+  p->ioH         = ioH;
+  p->syncAppId   = syncAppId;
+  p->syncUuId    = kInvalidId;
+  p->args        = args;
+  p->valueA      = mem::allocZ<value_t>(args.maxValueCnt);
+  p->logA        = mem::allocZ<char*>(args.maxLogLineCnt);
+  p->logUuId     = kInvalidId;
+  p->byte_tokens = args.byte_per_sec / 4;
+
+  time::get(p->exec_time);
+  p->ping_time = p->exec_time;
+  p->note_time = p->exec_time;
+
+  hRef.set(p);
+
+  return rc;
+}
+
+cw::rc_t caw::ui_send::destroy( handle_t& hRef )
+{
+  rc_t rc = kOkRC;
+
+  if( !hRef.isValid() )
+    return rc;
+
+  ui_send_t* p = _handleToPtr(hRef);
+
+  if((rc = _destroy(p)) != kOkRC )
+    return cwLogError(rc,"UI send destroy failed.");
+
+  hRef.clear();
+
+  return rc;
+}
+
+void caw::ui_send::on_connect( handle_t h, unsigned wsSessId )
+{
+  if( !h.isValid() )
+    return;
+
+  ui_send_t* p = _handleToPtr(h);
+
+  if( _find_sess(p,wsSessId) != nullptr )
+    return;
+
+  for(unsigned i=0; i<kMaxSessN; ++i)
+    if( !p->sessA[i].validFl )
+    {
+      p->sessA[i]            = {};
+      p->sessA[i].validFl    = true;
+      p->sessA[i].wsSessId   = wsSessId;
+      p->sessA[i].echoSeqId  = p->seqId;
+      time::get(p->sessA[i].echo_time);
+      return;
+    }
+
+  cwLogWarning("The UI session %i is not tracked because the session table is full.",wsSessId);
+}
+
+void caw::ui_send::on_disconnect( handle_t h, unsigned wsSessId )
+{
+  if( !h.isValid() )
+    return;
+
+  sess_t* s;
+  if((s = _find_sess(_handleToPtr(h),wsSessId)) != nullptr )
+    s->validFl = false;
+}
+
+void caw::ui_send::on_sync( handle_t h, unsigned wsSessId, unsigned seqId )
+{
+  if( !h.isValid() )
+    return;
+
+  sess_t* s;
+  if((s = _find_sess(_handleToPtr(h),wsSessId)) != nullptr )
+  {
+    if( s->ignoreFl )
+      cwLogInfo("UI session %i is echoing the sync sequence again.",wsSessId);
+
+    s->echoSeqId = seqId;
+    s->echoFl    = true;
+    s->ignoreFl  = false;
+    time::get(s->echo_time);
+  }
+}
+
+cw::rc_t caw::ui_send::value( handle_t h, unsigned uuId, double value )
+{
+  ui_send_t* p = _handleToPtr(h);
+  unsigned   i = 0;
+
+  for(; i<p->valueN; ++i)
+    if( p->valueA[i].uuId == uuId )
+      break;
+
+  if( i == p->valueN )
+  {
+    // the table is full - send the value immediately
+    if( p->valueN == p->args.maxValueCnt )
+      return uiSendValue( p->ioH, uuId, value );
+
+    p->valueA[i].uuId = uuId;
+    p->valueN        += 1;
+  }
+
+  if( p->valueA[i].pendingFl )
+    p->coalesce_cnt += 1;
+
+  p->valueA[i].value     = value;
+  p->valueA[i].pendingFl = true;
+  p->value_cnt          += 1;
+
+  return kOkRC;
+}
+
+cw::rc_t caw::ui_send::log_line( handle_t h, unsigned logUuId, const char* text )
+{
+  ui_send_t*                  p = _handleToPtr(h);
+  std::lock_guard<std::mutex> lock(p->logMutex);
+  unsigned                    nextHead = (p->logHead + 1) % p->args.maxLogLineCnt;
+
+  p->logUuId = logUuId;
+
+  if( nextHead == p->logTail )
+  {
+    p->log_drop_cnt      += 1;
+    p->log_drop_note_cnt += 1;
+    return kOkRC;
+  }
+
+  p->logA[ p->logHead ] = mem::duplStr(text);
+  p->logHead            = nextHead;
+
+  return kOkRC;
+}
+
+cw::rc_t caw::ui_send::exec( handle_t h )
+{
+  rc_t rc = kOkRC;
+
+  if( !h.isValid() )
+    return rc;
+
+  ui_send_t*   p          = _handleToPtr(h);
+  bool         pendingFl  = false;
+  time::spec_t now;
+
+  time::get(now);
+
+  // send the next sequence number - each session echoes it back
+  if( time::elapsedMicros(p->ping_time,now) >= p->args.ping_period_ms * 1000ull )
+  {
+    p->seqId    += 1;
+    p->ping_time = now;
+
+    if( p->syncUuId == kInvalidId )
+      p->syncUuId = io::uiFindElementUuId( p->ioH, p->syncAppId );
+
+    if( p->syncUuId != kInvalidId )
+      uiSendValue( p->ioH, p->syncUuId, (int)p->seqId );
+
+    _update_lag(p,now);
+  }
+
+  // refill the budget - a lagging session reduces the budget to a quarter
+  double dt_sec   = time::elapsedMicros(p->exec_time,now) / 1000000.0;
+  double rate     = p->lagFl ? p->args.byte_per_sec / 4.0 : p->args.byte_per_sec;
+  double burst    = std::max(rate / 4.0, (double)kValueByteCnt);
+
+  p->exec_time    = now;
+  p->byte_tokens  = std::min(p->byte_tokens + rate * dt_sec, burst);
+  p->line_tokens  = std::min(p->line_tokens + p->args.lag_log_lines_per_sec * dt_sec, (double)std::max(1u,p->args.lag_log_lines_per_sec));
+
+  if( p->logUuId != kInvalidId )
+    if((rc = _flush_log(p,now)) != kOkRC )
+      goto errLabel;
+
+  if((rc = _flush_values(p,pendingFl)) != kOkRC )
+    goto errLabel;
+
+  p->congestedFl = pendingFl || p->lagFl;
+
+errLabel:
+  return rc;
+}
+
+bool caw::ui_send::is_congested( handle_t h )
+{
+  return h.isValid() && _handleToPtr(h)->congestedFl;
+}
+
+void caw::ui_send::report( handle_t h )
+{
+  if( !h.isValid() )
+    return;
+
+  ui_send_t* p = _handleToPtr(h);
+  u64_t      log_drop_cnt;
+
+  {
+    std::lock_guard<std::mutex> lock(p->logMutex);
+    log_drop_cnt = p->log_drop_cnt;
+  }
+
+  cwLogInfo("UI send: bytes:%llu values:%llu sent:%llu coalesced:%llu log lines sent:%llu dropped:%llu %s",
+            p->byte_cnt, p->value_cnt, p->value_send_cnt, p->coalesce_cnt, p->log_send_cnt, log_drop_cnt, p->lagFl ? "(lagging)" : "");
+
+  for(unsigned i=0; i<kMaxSessN; ++i)
+    if( p->sessA[i].validFl )
+      cwLogInfo("  session:%i lag:%i ms max lag:%i ms%s",p->sessA[i].wsSessId,_sess_lag_ms(p,p->sessA+i),p->sessA[i].max_lag_ms,
+                !p->sessA[i].echoFl ? " (never echoed)" : p->sessA[i].ignoreFl ? " (not echoing)" : p->sessA[i].lagFl ? " (lagging)" : "");
+}
@@ -0,0 +1,70 @@
+//| Copyright: (C) 2020-2024 Kevin Larke <contact AT larke DOT org>
+//| License: GNU GPL version 3.0 or above. See the accompanying LICENSE file.
+#ifndef cawUiSend_h
+#define cawUiSend_h
+
+// Rate limited UI output for caw generated traffic (log lines and meters).
+//
+// value() stores the latest value for each UI element - a value which is
+// superseded before it is sent is never sent. log_line() queues a line of log
+// text. exec(), called from the UI thread, sends the queued values and lines
+// within a byte budget.
+//
+// Each session echoes a sequence number which is sent every 'ping_period_ms'.
+// The difference between the current and the echoed sequence number gives the
+// session lag. Each session's lag state is tracked separately. While any session
+// lags by more than 'lag_thresh_ms' the byte budget is reduced, log lines are
+// limited to 'lag_log_lines_per_sec' and the excess lines are dropped and replaced
+// by a count of dropped lines. The libcw UI sends every message to all sessions,
+// so the reduced budget applies to all of them.
+//
+// A session which has not echoed for 'sync_timeout_ms' - because it never echoes
+// (e.g. a cached ui.js from before the sync element existed) or because it stopped -
+// is not measured and does not throttle the other sessions until it echoes again.
+
+namespace caw
+{
+  namespace ui_send
+  {
+    typedef cw::handle<struct ui_send_str> handle_t;
+
+    typedef struct args_str
+    {
+      unsigned byte_per_sec;          // send budget
+      unsigned ping_period_ms;        // sequence number send period
+      unsigned lag_thresh_ms;         // lag at which a session is considered to be lagging
+      unsigned lag_log_lines_per_sec; // max. log line rate while a session is lagging
+      unsigned sync_timeout_ms;       // a session which has not echoed for this long is ignored
+      unsigned maxValueCnt;           // max. count of UI elements with a pending value
+      unsigned maxLogLineCnt;         // max. count of queued log lines
+    } args_t;
+
+    void default_args( args_t& args );
+
+    // syncAppId is the app id of the UI element which carries the sequence number.
+    cw::rc_t create( handle_t& hRef, cw::io::handle_t ioH, unsigned syncAppId, const args_t& args );
+    cw::rc_t destroy( handle_t& hRef );
+
+    // Session tracking. (UI thread)
+    void on_connect( handle_t h, unsigned wsSessId );
+    void on_disconnect( handle_t h, unsigned wsSessId );
+    void on_sync( handle_t h, unsigned wsSessId, unsigned seqId );
+
+    // Queue a value for a UI element. (UI thread)
+    cw::rc_t value( handle_t h, unsigned uuId, double value );
+
+    // Queue a line of log text. (Any thread)
+    cw::rc_t log_line( handle_t h, unsigned logUuId, const char* text );
+
+    // Send the queued values and log lines. (UI thread)
+    cw::rc_t exec( handle_t h );
+
+    // Return true if values were left unsent by the last exec() or a session is lagging.
+    bool is_congested( handle_t h );
+
+    // Print the per-session lag and the drop/coalesce counts.
+    void report( handle_t h );
+  }
+}
+
+#endif
@@ -696,7 +696,11 @@ function ui_create_text_display( parent_ele, d )
 
 function ui_set_progress( ele, value )
 {
-    ele.value = Math.round( ele.max * (value - ele.minValue) / (ele.maxValue - ele.minValue));
+    let v = Math.round( ele.max * (value - ele.minValue) / (ele.maxValue - ele.minValue));
+
+    // avoid a re-layout when the value did not move by a step
+    if( ele.value != v )
+	ele.value = v;
 }
 
 function _ui_set_prog_range( ele, d )
@@ -845,6 +849,10 @@ function ui_set_value( d )
 
 	    case "numb_disp":
 	    ui_set_number_display(ele.id,d.value);
+
+	    // echo the sequence number so that the server can measure the lag of this session
+	    if( ele.classList.contains("uiSync") )
+		ui_send_int_value(ele,d.value);
 	    break;
 	    
 	    case "progress":
@@ -11,17 +11,30 @@
 #include "cwIo.h"
 #include "cwVectOps.h"
 #include "cwTracer.h"
+#include "cwTime.h"
+#include "cwMidiDecls.h"
 
 #include "cwFlowDecl.h"
 #include "cwIoFlowCtl.h"
 
 #include "cawUiDecl.h"
 #include "cawUi.h"
+#include "cawMix.h"
+#include "cawMidiQueue.h"
+#include "cawTrace.h"
+#include "cawMetrics.h"
+#include "cawUiSend.h"
+#include "cawMeter.h"
+#include "cawMidiRec.h"
+#include "cawPrefetch.h"
+#include "cawRt.h"
 
 #include "cwTest.h"
 
 
 #include <ctime>
+#include <algorithm>
+#include <atomic>
 
 using namespace cw;
 using namespace caw::ui;
@@ -61,13 +74,35 @@ typedef struct app_str
   unsigned              pgm_preset_idx;     // currently selected pgm preset
   
   bool                  run_fl;             // true if the program is running (and the 'run' check is checked)
+  bool                  ui_init_fl;         // true after the first UI session was initialized
+  unsigned              dsp_frame_mult;     // count of device sub-blocks processed per network pass (cfg. 'dsp_frame_mult')
   
   io::handle_t          ioH;
   io_flow_ctl::handle_t ioFlowH;
   caw::ui::handle_t     uiH;
 
+  caw::midi_queue::handle_t      midiQueueH;    // MIDI input -> audio thread queue
+  const caw::midi_queue::msg_t*  cycle_midiA;   // MIDI msgs which apply to the current audio cycle
+  unsigned                       cycle_midiN;   //
+  std::atomic<unsigned>          midi_groupId;  // audio group which clocks the MIDI queue (the first group to call back)
+  caw::midi_rec::handle_t        midiRecH;      // streaming MIDI input recorder (cfg. 'midi_rec')
+
   const object_t*       tracer_cfg;
   tracer::handle_t      tracerH;
+  caw::trace::handle_t  traceH;             // span recorder (Chrome trace-event export)
+  const char*           trace_json_fname;   // trace-event output file (cfg. 'tracer.json_fname')
+  const char*           trace_dump_prefix;  // flight recorder dump file prefix (cfg. 'tracer.dump_prefix')
+  bool                  trace_auto_dump_fl; // dump the flight recorder after a deadline miss
+  unsigned              trace_dump_delay_ms; // time between a deadline miss and the automatic dump
+  unsigned              trace_dump_cnt;     // count of dump files written
+  unsigned              trace_miss_cnt;     // count of deadline misses which have been handled
+  bool                  trace_dump_pending_fl;
+  time::spec_t          trace_miss_time;    // time of the first deadline miss of a pending dump
+  caw::metrics::handle_t metricsH;          // metrics file writer (cfg. 'metrics')
+  caw::ui_send::handle_t uiSendH;           // rate limited UI output (cfg. 'ui_send')
+  caw::meter::handle_t  meterH;             // device channel meters (cfg. 'meter')
+  caw::prefetch::handle_t prefetchH;        // program file read-ahead - runs while the program is initialized (cfg. 'prefetch')
+  caw::rt::handle_t     rtH;                // real-time thread and memory settings (cfg. 'rt')
   
 } app_t;
 
@@ -79,6 +114,8 @@ ui::appIdMap_t  appIdMapA[] = {
   { kPanelDivId,     kNetPrintBtnId,  "netPrintBtnId" },
   { kPanelDivId,     kReportBtnId,    "reportBtnId" },
   { kPanelDivId,     kLatencyBtnId,   "latencyBtnId" },
+  { kPanelDivId,     kTraceCheckId,   "traceCheckId" },
+  { kPanelDivId,     kTraceDumpBtnId, "traceDumpBtnId" },
 
   { kPanelDivId,     kReloadIoBtnId,  "reloadIoBtnId" },
   { kPanelDivId,     kReloadPgmBtnId, "reloadPgmBtnId"},
@@ -90,6 +127,8 @@ ui::appIdMap_t  appIdMapA[] = {
   { kPanelDivId,     kRunCheckId,     "runCheckId" },
 
   { kPanelDivId,     kLogId,           "logId" },
+  { kPanelDivId,     kMeterListId,     "meterListId" },
+  { kPanelDivId,     kSyncSeqId,       "syncSeqId" },
   
   { kPanelDivId,     kRootNetPanelId, "rootNetPanelId" },
   { kRootNetPanelId, kNetListId,      "netListId" },
@@ -117,6 +156,150 @@ void print( void* arg, const char* text )
   printf("%s\n",text);
 }
 
+// Return the count of audio cycles per second summed over all audio groups.
+double _audio_cycles_per_second( const object_t* io_cfg )
+{
+  const object_t* audio_cfg = nullptr;
+  const object_t* groupL    = nullptr;
+  double          cps       = 0;
+
+  if( io_cfg == nullptr || io_cfg->getv_opt("audio",audio_cfg) != kOkRC || audio_cfg == nullptr )
+    return cps;
+
+  if( audio_cfg->getv_opt("groupL",groupL) != kOkRC || groupL == nullptr )
+    return cps;
+
+  for(unsigned i=0; i<groupL->child_count(); ++i)
+  {
+    double   srate       = 0;
+    unsigned dspFrameCnt = 0;
+
+    if( groupL->child_ele(i)->readv("srate",       kOptFl, srate,
+                                    "dspFrameCnt", kOptFl, dspFrameCnt ) == kOkRC && dspFrameCnt > 0 )
+      cps += srate / dspFrameCnt;
+  }
+
+  return cps;
+}
+
+// Configure the span recorder from the 'tracer' cfg. record.
+//
+// If 'enable_fl' is set all spans are recorded, up to 'span_cnt', and written to 'json_fname' on exit.
+// Otherwise the recorder runs as a flight recorder which holds the last 'flight_secs' of spans.
+// The flight recorder is armed by the 'Trace' check box and dumped by the 'Dump Trace' button or,
+// if 'auto_dump_fl' is set, 'dump_delay_ms' after an audio callback misses its deadline.
+rc_t _trace_span_start( app_t& app )
+{
+  rc_t        rc          = kOkRC;
+  bool        enable_fl   = false;
+  bool        activate_fl = false;
+  unsigned    span_cnt    = 262144;
+  double      flight_secs = 10;
+  const char* json_fname  = "trace.json";
+
+  app.trace_dump_prefix   = "trace_dump";
+  app.trace_auto_dump_fl  = true;
+  app.trace_dump_delay_ms = 500;
+  
+  if( app.tracer_cfg != nullptr )
+    if((rc = app.tracer_cfg->readv("enable_fl",     kOptFl, enable_fl,
+                                   "activate_fl",   kOptFl, activate_fl,
+                                   "span_cnt",      kOptFl, span_cnt,
+                                   "json_fname",    kOptFl, json_fname,
+                                   "flight_secs",   kOptFl, flight_secs,
+                                   "dump_prefix",   kOptFl, app.trace_dump_prefix,
+                                   "auto_dump_fl",  kOptFl, app.trace_auto_dump_fl,
+                                   "dump_delay_ms", kOptFl, app.trace_dump_delay_ms)) != kOkRC )
+    {
+      rc = cwLogError(rc,"The 'tracer' span recorder cfg. could not be parsed.");
+      goto errLabel;
+    }
+
+  // only the full trace is written on exit
+  app.trace_json_fname = enable_fl ? json_fname : nullptr;
+  
+  if( app.traceH.isValid() )
+  {
+    if( enable_fl )
+      caw::trace::set_active(app.traceH,activate_fl);
+    goto errLabel;
+  }
+
+  // the audio thread reads 'traceH' - so it can only be created before the IO framework starts
+  if( app.ioH.isValid() )
+  {
+    cwLogWarning("The trace span recorder can only be created at startup.");
+    goto errLabel;
+  }
+
+  if( enable_fl )
+    rc = caw::trace::create(app.traceH,span_cnt,false,activate_fl);
+  else
+  {
+    // audio_cb + flow_exec spans per cycle plus room for the control and UI spans
+    double cps = std::max(_audio_cycles_per_second(app.io_cfg),1000.0);
+    rc = caw::trace::create(app.traceH,std::max(1u,(unsigned)(flight_secs * cps * 3)),true,false);
+  }
+
+errLabel:
+  return rc;
+}
+
+// Write the contents of the span recorder to a new '<dump_prefix>_<n>.json' file.
+rc_t _trace_dump( app_t& app )
+{
+  rc_t   rc  = kOkRC;
+  char   fname[ 256 ];
+  char   date[ 32 ];
+  time_t now = std::time(nullptr);
+
+  if( !app.traceH.isValid() )
+    return rc;
+
+  // the date keeps the dumps of earlier runs from being overwritten
+  strftime(date,sizeof(date),"%Y%m%d_%H%M%S",localtime(&now));
+  snprintf(fname,sizeof(fname),"%s_%s_%i.json",app.trace_dump_prefix==nullptr ? "trace_dump" : app.trace_dump_prefix, date, app.trace_dump_cnt++);
+
+  if((rc = caw::trace::write_json(app.traceH,fname)) != kOkRC )
+    rc = cwLogError(rc,"Trace dump failed.");
+
+  return rc;
+}
+
+// Called periodically from the main thread. Dump the flight recorder after a deadline miss.
+void _trace_poll( app_t& app )
+{
+  unsigned     miss_cnt = caw::trace::deadline_miss_count(app.traceH);
+  time::spec_t now;
+
+  if( miss_cnt == app.trace_miss_cnt )
+    return;
+
+  if( !app.trace_auto_dump_fl || !caw::trace::is_active(app.traceH) )
+  {
+    app.trace_miss_cnt = miss_cnt;
+    return;
+  }
+
+  time::get(now);
+
+  // note the time of the first miss - misses which occur before the dump is written are part of the same dump
+  if( !app.trace_dump_pending_fl )
+  {
+    app.trace_dump_pending_fl = true;
+    app.trace_miss_time       = now;
+    cwLogWarning("Audio deadline miss - the trace will be dumped in %i ms.",app.trace_dump_delay_ms);
+  }
+
+  // wait 'dump_delay_ms' so that the dump includes the period following the miss
+  if( time::elapsedMicros(app.trace_miss_time,now) >= app.trace_dump_delay_ms * 1000ull )
+  {
+    _trace_dump(app);
+    app.trace_dump_pending_fl = false;
+    app.trace_miss_cnt        = caw::trace::deadline_miss_count(app.traceH);
+  }
+}
+
 rc_t _tracer_start( app_t& app )
 {
   rc_t rc = kOkRC;
@@ -138,6 +321,10 @@ rc_t _tracer_start( app_t& app )
       set_global_handle(app.tracerH);  
   }
 
+  // the span recorder is always created - without a 'tracer' cfg. it runs as a disarmed flight recorder
+  if( rc == kOkRC )
+    rc = _trace_span_start(app);
+
 errLabel:
   if( rc != kOkRC )
     rc = cwLogError(rc,"Tracer instantiation failed.");
@@ -159,11 +346,279 @@ rc_t _tracer_terminate( app_t& app )
     
   }
 
-  app.tracer_cfg = nullptr;
+  // the span recorder outlives cfg. reloads - only the file is written here
+  if( app.traceH.isValid() && app.trace_json_fname != nullptr )
+    if((rc = caw::trace::write_json(app.traceH,app.trace_json_fname)) != kOkRC )
+      rc = cwLogError(rc,"Trace span write failed.");
+
+  app.tracer_cfg        = nullptr;
+  app.trace_json_fname  = nullptr;
+  app.trace_dump_prefix = nullptr;
   
   return rc;
 }
 
+// Return the smallest 'framesPerCycle' of the devices which source or sink the audio group 'group_label'.
+unsigned _audio_group_min_frames_per_cycle( const object_t* audio_cfg, const char* group_label )
+{
+  const object_t* deviceL = nullptr;
+  unsigned        min_frm_cnt = kInvalidCnt;
+
+  if( audio_cfg->getv_opt("deviceL",deviceL) != kOkRC || deviceL == nullptr )
+    return min_frm_cnt;
+
+  for(unsigned i=0; i<deviceL->child_count(); ++i)
+  {
+    const object_t* dev_cfg        = deviceL->child_ele(i);
+    const char*     in_group       = nullptr;
+    const char*     out_group      = nullptr;
+    unsigned        frames_per_cyc = kInvalidCnt;
+
+    if( dev_cfg->readv("inGroup",        kOptFl, in_group,
+                       "outGroup",       kOptFl, out_group,
+                       "framesPerCycle", kOptFl, frames_per_cyc ) != kOkRC )
+      continue;
+
+    if( textIsEqual(in_group,group_label) || textIsEqual(out_group,group_label) )
+      if( frames_per_cyc < min_frm_cnt )
+        min_frm_cnt = frames_per_cyc;
+  }
+
+  return min_frm_cnt;
+}
+
+// Print the network block size and the associated latency for each audio group.
+void _report_dsp_block( app_t& app )
+{
+  const object_t* audio_cfg = nullptr;
+  const object_t* groupL    = nullptr;
+
+  if( app.io_cfg == nullptr || app.io_cfg->getv_opt("audio",audio_cfg) != kOkRC || audio_cfg == nullptr )
+    return;
+
+  if( audio_cfg->getv_opt("groupL",groupL) != kOkRC || groupL == nullptr )
+    return;
+
+  for(unsigned i=0; i<groupL->child_count(); ++i)
+  {
+    const object_t* grp_cfg     = groupL->child_ele(i);
+    const char*     label       = nullptr;
+    double          srate       = 0;
+    unsigned        dspFrameCnt = 0;
+    unsigned        devFrameCnt = kInvalidCnt;
+
+    if( grp_cfg->readv("label",       kOptFl, label,
+                       "srate",       kOptFl, srate,
+                       "dspFrameCnt", kOptFl, dspFrameCnt ) != kOkRC || srate == 0 || dspFrameCnt == 0 )
+      continue;
+
+    devFrameCnt = _audio_group_min_frames_per_cycle(audio_cfg,label);
+
+    cwLogInfo("Audio group '%s': network block:%i frames (%5.2f ms) network passes per device cycle:%i dsp_frame_mult:%i.",
+              cwStringNullGuard(label),
+              dspFrameCnt,
+              dspFrameCnt * 1000.0 / srate,
+              devFrameCnt==kInvalidCnt ? 0 : devFrameCnt/dspFrameCnt,
+              std::max(app.dsp_frame_mult,1u));
+  }
+}
+
+// Create the metrics file writer if a 'metrics' record was given in the program cfg.
+// metrics: { period_ms:1000, fname:"metrics.txt", format:"prom" | "json" }
+rc_t _create_metrics( app_t& app )
+{
+  rc_t            rc          = kOkRC;
+  const object_t* metrics_cfg = nullptr;
+  const object_t* ui_cfg      = nullptr;
+  const char*     dir         = nullptr;
+  const char*     fname       = "metrics.txt";
+  const char*     format      = "prom";
+  unsigned        period_ms   = 1000;
+  unsigned        fmtId       = caw::metrics::kPromFmtId;
+
+  if( app.flow_cfg == nullptr || app.flow_cfg->getv_opt("metrics",metrics_cfg) != kOkRC || metrics_cfg == nullptr )
+    goto errLabel;
+
+  if((rc = metrics_cfg->readv("period_ms", kOptFl, period_ms,
+                              "fname",     kOptFl, fname,
+                              "format",    kOptFl, format)) != kOkRC )
+  {
+    rc = cwLogError(rc,"The 'metrics' cfg. record parse failed.");
+    goto errLabel;
+  }
+
+  if( textIsEqual(format,"json") )
+    fmtId = caw::metrics::kJsonFmtId;
+  else
+    if( !textIsEqual(format,"prom") )
+    {
+      rc = cwLogError(kInvalidArgRC,"The metrics format '%s' is not valid. Use 'prom' or 'json'.",cwStringNullGuard(format));
+      goto errLabel;
+    }
+
+  // the metrics file is served by the UI HTTP server - so it is written to the UI root directory
+  if( app.io_cfg != nullptr && app.io_cfg->getv_opt("ui",ui_cfg) == kOkRC && ui_cfg != nullptr )
+    ui_cfg->getv_opt("physRootDir",dir);
+
+  if( dir == nullptr )
+  {
+    cwLogWarning("The IO cfg. has no 'ui.physRootDir' - the metrics file will be written to the current directory.");
+    dir = ".";
+  }
+
+  if((rc = caw::metrics::create(app.metricsH,dir,fname,fmtId,period_ms)) != kOkRC )
+  {
+    rc = cwLogError(rc,"Metrics create failed.");
+    goto errLabel;
+  }
+
+errLabel:
+  return rc;
+}
+
+// Create the rate limited UI output used for log lines and meters.
+// ui_send: { byte_per_sec:262144, ping_period_ms:250, lag_thresh_ms:1000, lag_log_lines_per_sec:10, sync_timeout_ms:10000, max_value_cnt:256, max_log_line_cnt:256 }
+rc_t _create_ui_send( app_t& app )
+{
+  rc_t                 rc       = kOkRC;
+  const object_t*      send_cfg = nullptr;
+  caw::ui_send::args_t args;
+
+  caw::ui_send::default_args(args);
+
+  if( app.flow_cfg != nullptr && app.flow_cfg->getv_opt("ui_send",send_cfg) == kOkRC && send_cfg != nullptr )
+    if((rc = send_cfg->readv("byte_per_sec",          kOptFl, args.byte_per_sec,
+                             "ping_period_ms",        kOptFl, args.ping_period_ms,
+                             "lag_thresh_ms",         kOptFl, args.lag_thresh_ms,
+                             "lag_log_lines_per_sec", kOptFl, args.lag_log_lines_per_sec,
+                             "sync_timeout_ms",       kOptFl, args.sync_timeout_ms,
+                             "max_value_cnt",         kOptFl, args.maxValueCnt,
+                             "max_log_line_cnt",      kOptFl, args.maxLogLineCnt)) != kOkRC )
+    {
+      rc = cwLogError(rc,"The 'ui_send' cfg. record parse failed.");
+      goto errLabel;
+    }
+
+  if((rc = caw::ui_send::create(app.uiSendH,app.ioH,kSyncSeqId,args)) != kOkRC )
+  {
+    rc = cwLogError(rc,"UI send create failed.");
+    goto errLabel;
+  }
+
+errLabel:
+  return rc;
+}
+
+// Create the device channel meters if a 'meter' record was given in the program cfg.
+// meter: { period_ms:50, max_period_ms:500, max_msg_per_sec:400, min_db:-100, max_db:0, hold_ms:1500, decay_db_per_sec:20, max_ch_cnt:64 }
+rc_t _create_meters( app_t& app )
+{
+  rc_t                 rc        = kOkRC;
+  const object_t*      meter_cfg = nullptr;
+  bool                 enable_fl = true;
+  caw::meter::args_t   args;
+
+  caw::meter::default_args(args);
+
+  if( app.flow_cfg == nullptr || app.flow_cfg->getv_opt("meter",meter_cfg) != kOkRC || meter_cfg == nullptr )
+    goto errLabel;
+
+  if((rc = meter_cfg->readv("enable_fl",        kOptFl, enable_fl,
+                            "period_ms",        kOptFl, args.period_ms,
+                            "max_period_ms",    kOptFl, args.max_period_ms,
+                            "max_msg_per_sec",  kOptFl, args.max_msg_per_sec,
+                            "min_db",           kOptFl, args.min_db,
+                            "max_db",           kOptFl, args.max_db,
+                            "hold_ms",          kOptFl, args.hold_ms,
+                            "decay_db_per_sec", kOptFl, args.decay_db_per_sec,
+                            "max_ch_cnt",       kOptFl, args.maxChCnt)) != kOkRC )
+  {
+    rc = cwLogError(rc,"The 'meter' cfg. record parse failed.");
+    goto errLabel;
+  }
+
+  if( enable_fl )
+    if((rc = caw::meter::create(app.meterH,app.ioH,app.uiSendH,args)) != kOkRC )
+    {
+      rc = cwLogError(rc,"Meter create failed.");
+      goto errLabel;
+    }
+
+errLabel:
+  return rc;
+}
+
+// Create the MIDI input queue if MIDI is enabled in the IO cfg.
+rc_t _create_midi_queue( app_t& app )
+{
+  rc_t            rc        = kOkRC;
+  const object_t* midi_cfg  = nullptr;
+  bool            enable_fl = false;
+  unsigned        msgCnt    = 4096;
+
+  app.midi_groupId.store(kInvalidId);
+
+  if( app.io_cfg == nullptr || app.io_cfg->getv_opt("midi",midi_cfg) != kOkRC || midi_cfg == nullptr )
+    goto errLabel;
+
+  if((rc = midi_cfg->readv("enableFl",     kOptFl, enable_fl,
+                           "bufferMsgCnt", kOptFl, msgCnt)) != kOkRC )
+  {
+    rc = cwLogError(rc,"The IO cfg. 'midi' section parse failed.");
+    goto errLabel;
+  }
+
+  if( enable_fl )
+    if((rc = caw::midi_queue::create(app.midiQueueH,msgCnt)) != kOkRC )
+    {
+      rc = cwLogError(rc,"MIDI input queue create failed.");
+      goto errLabel;
+    }
+
+errLabel:
+  return rc;
+}
+
+// Create the streaming MIDI input recorder if the program cfg has a 'midi_rec' record.
+rc_t _create_midi_rec( app_t& app )
+{
+  rc_t                    rc      = kOkRC;
+  const object_t*         rec_cfg = nullptr;
+  const char*             dir     = ".";
+  const char*             fname   = "midi";
+  caw::midi_rec::args_t   args;
+
+  caw::midi_rec::default_args(args);
+
+  if( app.flow_cfg == nullptr || app.flow_cfg->getv_opt("midi_rec",rec_cfg) != kOkRC || rec_cfg == nullptr )
+    goto errLabel;
+
+  if( !app.midiQueueH.isValid() )
+  {
+    cwLogWarning("MIDI is not enabled in the IO cfg. - the 'midi_rec' cfg. record is ignored.");
+    goto errLabel;
+  }
+
+  if((rc = rec_cfg->readv("dir",             kOptFl, dir,
+                          "fname",           kOptFl, fname,
+                          "ring_msg_cnt",    kOptFl, args.ringMsgCnt,
+                          "write_period_ms", kOptFl, args.write_period_ms,
+                          "fsync_period_ms", kOptFl, args.fsync_period_ms)) != kOkRC )
+  {
+    rc = cwLogError(rc,"The 'midi_rec' cfg. record parse failed.");
+    goto errLabel;
+  }
+
+  if((rc = caw::midi_rec::create(app.midiRecH,dir,fname,args)) != kOkRC )
+  {
+    rc = cwLogError(rc,"MIDI recorder create failed.");
+    goto errLabel;
+  }
+
+errLabel:
+  return rc;
+}
+
 rc_t _run_test_suite(int argc, const char** argv)
 {
   rc_t rc = kOkRC;
@@ -183,10 +638,40 @@ errLabel:
 }
 
 
+// Start reading the files referenced by the program into the page cache while it is initialized.
+// Configured by the optional program cfg. record 'prefetch' - disabled unless 'enable_fl' is set.
+rc_t _prefetch_start( app_t& app, const char* pgm_label )
+{
+  rc_t                   rc           = kOkRC;
+  const object_t*        prefetch_cfg = nullptr;
+  bool                   enable_fl    = false;
+  caw::prefetch::args_t  args;
+
+  caw::prefetch::default_args(args);
+
+  if( app.flow_cfg != nullptr && app.flow_cfg->getv_opt("prefetch",prefetch_cfg) == kOkRC && prefetch_cfg != nullptr )
+    if((rc = prefetch_cfg->readv("enable_fl",     kOptFl, enable_fl,
+                                 "thread_cnt",    kOptFl, args.threadN,
+                                 "max_mb",        kOptFl, args.max_mb,
+                                 "log_period_ms", kOptFl, args.log_period_ms)) != kOkRC )
+    {
+      rc = cwLogError(rc,"The 'prefetch' cfg. record parse failed.");
+      goto errLabel;
+    }
+
+  if( enable_fl )
+    rc = caw::prefetch::start(app.prefetchH,app.flow_cfg,pgm_label,args);
+
+errLabel:
+  return rc;
+}
+
 rc_t _load_init_pgm_no_gui( app_t& app, const char* pgm_label, bool& exec_complete_fl_ref )
 {
-  rc_t     rc = kOkRC;
-  unsigned pgm_idx;
+  rc_t               rc = kOkRC;
+  unsigned           pgm_idx;
+  unsigned long long t0;
+  unsigned           fp_ctl;
 
   exec_complete_fl_ref = false;
   
@@ -196,18 +681,37 @@ rc_t _load_init_pgm_no_gui( app_t& app, const char* pgm_label, bool& exec_comple
     goto errLabel;
   }
 
+  t0 = caw::trace::begin(app.traceH);
+  
   if((rc = program_load(app.ioFlowH,pgm_idx)) != kOkRC )
   {
     rc = cwLogError(rc,"Program load failed on '%s'.",cwStringNullGuard(pgm_label));
     goto errLabel;
   }
 
-  if((rc = program_initialize(app.ioFlowH)) != kOkRC )
+  caw::trace::end(app.traceH,caw::trace::kPgmLoadSpanId,t0,pgm_idx);
+
+  _prefetch_start(app,pgm_label);
+  
+  t0 = caw::trace::begin(app.traceH);
+
+  // threads created by program initialize inherit the FTZ/DAZ setting
+  fp_ctl = caw::rt::fp_env_begin(app.rtH);
+  rc     = program_initialize(app.ioFlowH);
+  caw::rt::fp_env_end(app.rtH,fp_ctl);
+
+  caw::prefetch::stop(app.prefetchH);
+  
+  if( rc != kOkRC )
   {
     rc = cwLogError(rc,"Program initialize failed on '%s'.",cwStringNullGuard(pgm_label));
     goto errLabel;
   }
 
+  caw::trace::end(app.traceH,caw::trace::kPgmInitSpanId,t0,pgm_idx);
+
+  caw::rt::lock_memory(app.rtH);
+
   // if the program is in NRT mode then run it
   if( is_program_nrt(app.ioFlowH) )
   {
@@ -228,19 +732,54 @@ rc_t _load_pgm_thread_func( void* arg )
   rc_t rc = kOkRC;
   app_t* app = (app_t*)arg;
   
-  const flow::ui_net_t* ui_net = nullptr;
+  unsigned long long    t0;
+  unsigned              fp_ctl;
+
+  // this thread is created by the UI thread - drop the UI thread's priority and affinity
+  // before the prefetch and program threads are created from it
+  caw::rt::reset_thread(app->rtH);
+
+  // warm the page cache with the program's files - program_initialize() reads them one processor at a time
+  if( program_current_index(app->ioFlowH) != kInvalidIdx )
+    _prefetch_start(*app, program_title(app->ioFlowH,program_current_index(app->ioFlowH)));
+
+  t0 = caw::trace::begin(app->traceH);
+
+  // Initialize the loaded program. Threads created by program initialize inherit the FTZ/DAZ setting.
+  fp_ctl = caw::rt::fp_env_begin(app->rtH);
+  rc     = program_initialize(app->ioFlowH, app->pgm_preset_idx );
+  caw::rt::fp_env_end(app->rtH,fp_ctl);
 
-  // Initialize the loaded program.
-  if((rc = program_initialize(app->ioFlowH, app->pgm_preset_idx )) != kOkRC )
+  caw::prefetch::stop(app->prefetchH);
+  
+  if( rc != kOkRC )
   {
     rc = cwLogError(rc,"Network initialization failed.");
     goto errLabel;
   }
 
+  caw::trace::end(app->traceH,caw::trace::kPgmInitSpanId,t0,app->pgm_preset_idx);
+
+  // lock the newly allocated program memory
+  caw::rt::lock_memory(app->rtH);
+
+  // The network UI is created by _on_load_pgm_thread_complete() on the UI thread.
+
+errLabel:
+  return rc;
+}
+
+// Create the network UI of the initialized program.
+// This must run on the UI thread: the main loop reads the caw::ui widget table (echo(), exec_echo()) without a lock.
+rc_t _create_network_ui( app_t* app )
+{
+  rc_t                  rc     = kOkRC;
+  const flow::ui_net_t* ui_net = nullptr;
+  
   // Get the loaded programs network UI description.
   if((ui_net = program_ui_net(app->ioFlowH)) == nullptr )
   {
-    rc = cwLogError(rc,"Network UI description initialization failed.");
+    rc = cwLogError(kInvalidStateRC,"Network UI description initialization failed.");
     goto errLabel;      
   }
 
@@ -266,6 +805,11 @@ rc_t _on_load_pgm_thread_complete(app_t* app)
   unsigned pgmPresetSelUuId = io::uiFindElementUuId( app->ioH, kPgmPresetSelId );
   unsigned pgmLoadBtnUuId   = io::uiFindElementUuId( app->ioH, kPgmLoadBtnId );
 
+  // if the loader thread initialized the program then create its UI
+  if( program_is_initialized(app->ioFlowH) )
+    if((rc = _create_network_ui(app)) != kOkRC )
+      goto errLabel;
+
   // populate the preset menu
   for(unsigned i=0; i<preset_cnt; ++i)
   {
@@ -297,6 +841,7 @@ rc_t _do_pgm_select(app_t* app, unsigned pgm_idx )
   unsigned pgmPrintBtnUuId  = io::uiFindElementUuId( app->ioH, kPgmPrintBtnId );
   unsigned runCheckUuId     = io::uiFindElementUuId( app->ioH, kRunCheckId );
   unsigned preset_cnt       = 0;
+  unsigned long long t0;
   
   // empty the contents of the preset select menu
   if((rc = uiEmptyParent(app->ioH,pgmPresetSelUuId)) != kOkRC )
@@ -312,13 +857,24 @@ rc_t _do_pgm_select(app_t* app, unsigned pgm_idx )
   app->pgm_preset_idx = kInvalidIdx;                 // The preset menu is empty and so there can be no valid preset selected.
 
 
+  // the widget table refers to the variables of the current network - release it before program_load() replaces the network
+  if((rc = caw::ui::destroy(app->uiH)) != kOkRC )
+  {
+    rc = cwLogError(rc,"The network UI destroy failed.");
+    goto errLabel;
+  }
+
   // load the program
+  t0 = caw::trace::begin(app->traceH);
+  
   if((rc = program_load(app->ioFlowH, pgm_idx )) != kOkRC )
   {
     rc = cwLogError(rc,"Program load failed.");
     goto errLabel;
   }
 
+  caw::trace::end(app->traceH,caw::trace::kPgmLoadSpanId,t0,pgm_idx);
+
   preset_cnt = program_preset_count(app->ioFlowH);
   
   // populate the preset menu
@@ -376,12 +932,18 @@ rc_t _on_pgm_preset_select( app_t* app, unsigned pgmPresetSelOptId )
   app->pgm_preset_idx = pgmPresetSelOptId - kPgmPresetBaseSelId;
 
   if( program_is_initialized(app->ioFlowH) )
+  {
+    unsigned long long t0 = caw::trace::begin(app->traceH);
+    
     if((rc = program_apply_preset( app->ioFlowH, app->pgm_preset_idx )) == kOkRC )
     {
+      caw::trace::end(app->traceH,caw::trace::kPresetApplySpanId,t0,app->pgm_preset_idx);
+      
       // if the app isn't running then update the UI manually
       if( !app->run_fl )
         rc = send_ui_updates(app->ioFlowH);
     }
+  }
 
 errLabel:
 
@@ -445,6 +1007,22 @@ rc_t _on_ui_init( app_t* app )
   rc_t rc = kOkRC;
   unsigned pgmSelUuId = io::uiFindElementUuId( app->ioH, kPgmSelId );
   unsigned pgm_cnt = program_count(app->ioFlowH);
+
+  // A session which connects after the first one receives the UI as it is now.
+  // Re-running the menu setup would reload the first program in the middle of a performance.
+  if( app->ui_init_fl )
+  {
+    uiSendValue( app->ioH, io::uiFindElementUuId( app->ioH, kRunCheckId ), app->run_fl );
+    uiSendValue( app->ioH, io::uiFindElementUuId( app->ioH, kTraceCheckId ), caw::trace::is_active(app->traceH) );
+
+    // The new session's variable widgets request their values with echo msgs.
+    // These are merged and answered in one pass by caw::ui::exec_echo().
+
+    caw::meter::invalidate(app->meterH);
+    goto errLabel;
+  }
+
+  app->ui_init_fl = true;
   
   // create pgm menu
   for(unsigned i=0; i<pgm_cnt; ++i)
@@ -460,6 +1038,11 @@ rc_t _on_ui_init( app_t* app )
   if( pgm_cnt )
     _on_pgm_select(app, kPgmBaseSelId );
 
+  uiSendValue( app->ioH, io::uiFindElementUuId( app->ioH, kTraceCheckId ), caw::trace::is_active(app->traceH) );
+
+  // the new session has not seen the current meter values
+  caw::meter::invalidate(app->meterH);
+
 errLabel:
   return rc;
 }
@@ -577,6 +1160,7 @@ rc_t _on_reload_cfg_file(app_t* app)
   }
 
   // Setup the UI based on the reloaded file
+  app->ui_init_fl = false;
   if((rc = _on_ui_init( app )) != kOkRC )
   {
     goto errLabel;
@@ -630,19 +1214,39 @@ rc_t _ui_value_callback(app_t* app, const io::ui_msg_t& m )
       
     case kIoReportBtnId:
       io::report(app->ioH);
+      caw::ui_send::report(app->uiSendH);
+      caw::rt::report(app->rtH);
       break;
       
     case kNetPrintBtnId:
       break;
       
     case kReportBtnId:
+      caw::meter::report(app->meterH);
       break;
       
     case kLatencyBtnId:
       latency_measure_report(app->ioH);
+      _report_dsp_block(*app);
+      caw::midi_queue::report(app->midiQueueH);
+      caw::midi_queue::reset_stats(app->midiQueueH);
+      caw::midi_rec::report(app->midiRecH);
       latency_measure_setup(app->ioH);
       break;
 
+    case kSyncSeqId:
+      caw::ui_send::on_sync(app->uiSendH,m.wsSessId,m.value->u.i);
+      break;
+
+    case kTraceCheckId:
+      caw::trace::set_active(app->traceH,m.value->u.b);
+      cwLogInfo("Trace flight recorder %s.",m.value->u.b ? "armed" : "disarmed");
+      break;
+
+    case kTraceDumpBtnId:
+      _trace_dump(*app);
+      break;
+
     case kReloadIoBtnId:      
       break;
 
@@ -749,6 +1353,10 @@ errLabel:
 rc_t _ui_echo_callback(app_t* app, const io::ui_msg_t& m )
 {
   rc_t rc = kOkRC;
+
+  // queue the echo to be answered with the others received during this cycle
+  if( app->uiH.isValid() && caw::ui::echo(app->uiH,m.uuId) == kOkRC )
+    return rc;
   
   switch( m.appId )
   {
@@ -792,10 +1400,12 @@ rc_t _ui_callback( app_t* app, const io::ui_msg_t& m )
   {
     case ui::kConnectOpId:
       cwLogInfo("UI Connected: wsSessId:%i.",m.wsSessId);
+      caw::ui_send::on_connect(app->uiSendH,m.wsSessId);
       break;
           
     case ui::kDisconnectOpId:
       cwLogInfo("UI Disconnected: wsSessId:%i.",m.wsSessId);          
+      caw::ui_send::on_disconnect(app->uiSendH,m.wsSessId);
       break;
           
     case ui::kInitOpId:
@@ -856,23 +1466,53 @@ rc_t _io_callback( void* arg, const io::msg_t* m )
       break;
       
     case io::kMidiTId:
+      caw::rt::on_thread(app->rtH,caw::rt::kMidiThreadId);
+      if( app->midiQueueH.isValid() && m->u.midi != nullptr )
+        caw::midi_queue::push(app->midiQueueH,m->u.midi->pkt);
       break;
       
     case io::kAudioTId:
       {
-        bool executable_fl = is_executable(app->ioFlowH);
+        caw::rt::on_thread(app->rtH,caw::rt::kAudioThreadId);
+        
+        bool               executable_fl = is_executable(app->ioFlowH);
+        unsigned long long cb_t0         = caw::trace::begin(app->traceH);
+        time::spec_t       metrics_t0;
+
+        if( app->metricsH.isValid() )
+          time::get(metrics_t0);
+
+        // collect the MIDI msgs which arrived during the previous cycle - the queue's frame clock
+        // advances once per cycle and so it is only driven by one audio group
+        unsigned midi_groupId = kInvalidId;
+        if( m != nullptr )
+          app->midi_groupId.compare_exchange_strong(midi_groupId,m->u.audio->groupId);
+        
+        if( app->midiQueueH.isValid() && m != nullptr && app->midi_groupId.load() == m->u.audio->groupId )
+        {
+          app->cycle_midiN = caw::midi_queue::exec_cycle(app->midiQueueH, m->u.audio->srate, m->u.audio->dspFrameCnt, app->cycle_midiA );
+          caw::midi_rec::write(app->midiRecH, app->cycle_midiA, app->cycle_midiN );
+        }
 
         // if the app is executable and we are in 'run' mode
         if(app->run_fl && executable_fl  && m != nullptr )
         {
+          unsigned long long t0 = caw::trace::begin(app->traceH);
+          caw::rt::begin_cycle(app->rtH);
           io_flow_ctl::exec(app->ioFlowH,*m);
+          caw::rt::end_cycle(app->rtH);
+          caw::trace::end(app->traceH,caw::trace::kFlowExecSpanId,t0);
         }
         else
         {
+          // silence the output - contiguous device channels are cleared with a single memset()
           if( m != nullptr )
-            for(unsigned i=0; i<m->u.audio->oBufChCnt; ++i)
-              vop::zero(m->u.audio->oBufArray[i],m->u.audio->dspFrameCnt);
+            caw::mix::zero(m->u.audio->oBufArray,m->u.audio->oBufChCnt,m->u.audio->dspFrameCnt);
         }
+
+        // meter the output after it has been rendered (or silenced) for this cycle
+        if( app->meterH.isValid() && m != nullptr )
+          caw::meter::write(app->meterH, m->u.audio->iBufArray, m->u.audio->iBufChCnt, m->u.audio->oBufArray, m->u.audio->oBufChCnt, m->u.audio->dspFrameCnt );
         
         // if the app is not executable then we should exit run mode
         if(app->run_fl && !executable_fl )
@@ -883,7 +1523,13 @@ rc_t _io_callback( void* arg, const io::msg_t* m )
           if( app->cmd_line_action_id==kUiSelId )
             uiSendValue(app->ioH, io::uiFindElementUuId( app->ioH, kRunCheckId ), false );
         }
-        
+
+        if( m != nullptr && m->u.audio->srate > 0 )
+        {
+          double budget_us = m->u.audio->dspFrameCnt * 1000000.0 / m->u.audio->srate;
+          caw::trace::end_cycle(app->traceH,cb_t0,budget_us);
+          caw::metrics::cycle(app->metricsH,metrics_t0,budget_us);
+        }
       }
       break;
       
@@ -897,7 +1543,17 @@ rc_t _io_callback( void* arg, const io::msg_t* m )
       break;
       
     case io::kUiTId:
-      _ui_callback(app,m->u.ui);
+      {
+        unsigned long long t0 = caw::trace::begin(app->traceH);
+        
+        _ui_callback(app,m->u.ui);
+
+        caw::metrics::ui_msg(app->metricsH);
+
+        // idle msgs arrive continuously and are not traced
+        if( m->u.ui.opId != ui::kIdleOpId )
+          caw::trace::end(app->traceH,caw::trace::kUiMsgSpanId,t0,m->u.ui.appId);
+      }
       break;
       
     case io::kExecTId:
@@ -928,11 +1584,17 @@ void _log_output_func( void* arg, log::logLevelId_t level, const char* text )
 {
   app_t*   app     = (app_t*)arg;
 
+  caw::metrics::log_line(app->metricsH);
+
   if( app->ioH.isValid() && is_started_flag(app->ioH) )
   {  
     unsigned logUuId = uiFindElementUuId( app->ioH, kLogId);
-  
-    uiSetLogLine( app->ioH, logUuId, text );
+
+    // in GUI mode the log lines are rate limited along with the other caw UI output
+    if( app->uiSendH.isValid() )
+      caw::ui_send::log_line( app->uiSendH, logUuId, text );
+    else
+      uiSetLogLine( app->ioH, logUuId, text );
   }
 }
 
@@ -1091,6 +1753,85 @@ errLabel:
       
 }
 
+// Scale the 'dspFrameCnt' of each audio group by the cfg. 'dsp_frame_mult' so that
+// the network processes 'dsp_frame_mult' device sub-blocks in a single pass.
+// This amortizes the per-cycle overhead of heavy networks at the cost of
+// (dsp_frame_mult-1)*dspFrameCnt frames of additional latency.
+rc_t _apply_dsp_frame_mult( app_t& app )
+{
+  rc_t      rc        = kOkRC;
+  object_t* audio_cfg = nullptr;
+  object_t* groupL    = nullptr;
+  
+  if( app.dsp_frame_mult <= 1 )
+    goto errLabel;
+
+  if((audio_cfg = app.io_cfg->find_child("audio")) == nullptr || (groupL = audio_cfg->find_child("groupL")) == nullptr )
+  {
+    rc = cwLogError(kSyntaxErrorRC,"The IO cfg. does not have an 'audio.groupL' section.");
+    goto errLabel;
+  }
+
+  for(unsigned i=0; i<groupL->child_count(); ++i)
+  {
+    object_t*   grp_cfg     = groupL->child_ele(i);
+    object_t*   frm_cnt_cfg = nullptr;
+    const char* label       = nullptr;
+    unsigned    dspFrameCnt = 0;
+    unsigned    devFrameCnt = kInvalidCnt;
+    unsigned    mult        = app.dsp_frame_mult;
+
+    if((frm_cnt_cfg = grp_cfg->find_child("dspFrameCnt")) == nullptr || frm_cnt_cfg->value(dspFrameCnt) != kOkRC )
+    {
+      rc = cwLogError(kSyntaxErrorRC,"The audio group at index %i does not have a valid 'dspFrameCnt'.",i);
+      goto errLabel;
+    }
+
+    grp_cfg->getv_opt("label",label);
+
+    // the network block may not be larger than the device cycle and must evenly divide it
+    devFrameCnt = _audio_group_min_frames_per_cycle(audio_cfg,label);
+    while( mult > 1 && devFrameCnt != kInvalidCnt && (dspFrameCnt*mult > devFrameCnt || devFrameCnt % (dspFrameCnt*mult) != 0) )
+      --mult;
+
+    if( mult != app.dsp_frame_mult )
+      cwLogWarning("The 'dsp_frame_mult' was reduced from %i to %i for the audio group '%s' to fit the device cycle of %i frames.",app.dsp_frame_mult,mult,cwStringNullGuard(label),devFrameCnt);
+      
+    if((rc = frm_cnt_cfg->set_value(dspFrameCnt*mult)) != kOkRC )
+    {
+      rc = cwLogError(rc,"The 'dspFrameCnt' update failed on the audio group '%s'.",cwStringNullGuard(label));
+      goto errLabel;
+    }
+  }
+  
+  _report_dsp_block(app);
+
+errLabel:
+  if( rc != kOkRC )
+    rc = cwLogError(rc,"The 'dsp_frame_mult' could not be applied.");
+  
+  return rc;
+}
+
+rc_t _create_rt( app_t& app )
+{
+  rc_t            rc     = kOkRC;
+  const object_t* rt_cfg = nullptr;
+
+  if((rc = app.flow_cfg->getv_opt("rt",rt_cfg)) != kOkRC )
+  {
+    rc = cwLogError(rc,"An error occurred accessing the caw 'rt' cfg. field.");
+    goto errLabel;
+  }
+
+  if( rt_cfg != nullptr )
+    if((rc = caw::rt::create(app.rtH,rt_cfg)) != kOkRC )
+      rc = cwLogError(rc,"Real-time settings create failed.");
+
+errLabel:
+  return rc;
+}
+
 rc_t _parse_main_cfg( app_t& app, int argc, char* argv[] )
 {
   rc_t rc = kOkRC;
@@ -1140,6 +1881,11 @@ rc_t _parse_main_cfg( app_t& app, int argc, char* argv[] )
       goto errLabel;
     }
 
+    if((rc = _create_rt(app)) != kOkRC )
+    {
+      goto errLabel;
+    }
+
     // read the io cfg filename
     if((rc = app.flow_cfg->getv("io_dict", io_cfg_fn)) != kOkRC )
     {
@@ -1153,6 +1899,18 @@ rc_t _parse_main_cfg( app_t& app, int argc, char* argv[] )
       goto errLabel;
     }
 
+    // optionally increase the network block size
+    if((rc = app.flow_cfg->getv_opt("dsp_frame_mult",app.dsp_frame_mult)) != kOkRC )
+    {
+      rc = cwLogError(rc,"The 'dsp_frame_mult' cfg. field could not be read.");
+      goto errLabel;
+    }
+
+    if((rc = _apply_dsp_frame_mult(app)) != kOkRC )
+    {
+      goto errLabel;
+    }
+
     // if the 'exec' mode was selected then disable the UI
     if( app.cmd_line_action_id == kExecSelId )
     {
@@ -1186,15 +1944,31 @@ rc_t _io_main( app_t& app )
     goto errLabel;    
   }
 
+  // The UI settings are applied to this thread after the IO framework has created its
+  // threads so that they do not inherit the UI thread's priority and affinity.
+  caw::rt::on_thread(app.rtH,caw::rt::kUiThreadId);
+
   // execute the IO framework
   while( !io::isShuttingDown(app.ioH))
   {
     log::exec(log::globalHandle());
+
+    _trace_poll(app);
+
+    caw::metrics::exec(app.metricsH,app.midiQueueH);
+
+    caw::meter::exec(app.meterH);
+
+    caw::ui_send::exec(app.uiSendH);
+
+    caw::rt::exec(app.rtH);
     
     // This call will block on the websocket handle
     // for up to io_cfg->ui.websockTimeOutMs milliseconds
     io::exec(app.ioH,50);
 
+    caw::ui::exec_echo(app.uiH);
+
     if( is_exec_complete(app.ioFlowH) )
       break;
   }
@@ -1268,6 +2042,23 @@ int main( int argc, char* argv[] )
       break;
   }
   
+  // the MIDI queue must exist before the IO framework starts delivering MIDI
+  if((rc = _create_midi_queue(app)) != kOkRC )
+  {
+    goto errLabel;
+  }
+
+  if((rc = _create_midi_rec(app)) != kOkRC )
+  {
+    goto errLabel;
+  }
+
+  // the audio thread reads 'metricsH' - so it must also exist before the IO framework starts
+  if((rc = _create_metrics(app)) != kOkRC )
+  {
+    goto errLabel;
+  }
+
   // instantiate the IO framework
   if((rc = create( app.ioH, app.io_cfg, _io_callback, &app, appIdMapA, appIdMapN, nullptr )) != kOkRC )
   {
@@ -1282,6 +2073,20 @@ int main( int argc, char* argv[] )
     goto errLabel;
   }
 
+  // the rate limited UI output and the meters are only used by the GUI
+  if( app.cmd_line_action_id == kUiSelId )
+  {
+    if((rc = _create_ui_send(app)) != kOkRC )
+    {
+      goto errLabel;
+    }
+    
+    if((rc = _create_meters(app)) != kOkRC )
+    {
+      goto errLabel;
+    }
+  }
+
   switch( app.cmd_line_action_id )
   {
     case kHwReportSelId:
@@ -1329,11 +2134,33 @@ errLabel:
   if((rc = destroy(app.ioH)) != kOkRC )
     rc = cwLogError(rc,"IO destroy failed.");
 
+  if((rc = caw::meter::destroy(app.meterH)) != kOkRC )
+    rc = cwLogError(rc,"Meter destroy failed.");
+
+  if((rc = caw::ui_send::destroy(app.uiSendH)) != kOkRC )
+    rc = cwLogError(rc,"UI send destroy failed.");
+
   if((rc = destroy(app.uiH)) != kOkRC )
     rc = cwLogError(rc,"UI destroy failed.");
 
+  // the recorder writes the messages it has queued and syncs the file before it returns
+  if((rc = caw::midi_rec::destroy(app.midiRecH)) != kOkRC )
+    rc = cwLogError(rc,"MIDI recorder destroy failed.");
+
+  if((rc = caw::midi_queue::destroy(app.midiQueueH)) != kOkRC )
+    rc = cwLogError(rc,"MIDI queue destroy failed.");
+
   _tracer_terminate(app);
 
+  if((rc = caw::trace::destroy(app.traceH)) != kOkRC )
+    rc = cwLogError(rc,"Trace destroy failed.");
+
+  if((rc = caw::metrics::destroy(app.metricsH)) != kOkRC )
+    rc = cwLogError(rc,"Metrics destroy failed.");
+
+  if((rc = caw::rt::destroy(app.rtH)) != kOkRC )
+    rc = cwLogError(rc,"Real-time settings destroy failed.");
+
   if( app.io_cfg != nullptr )
     app.io_cfg->free();
   